@@ -0,0 +1,77 @@
+﻿#include "AdmissionController.h"
+#include "RequestTask.h"
+#include "Settings.h"
+
+#include <QThreadPool>
+
+AdmissionController::AdmissionController(QThreadPool* pool)
+    : _pool(pool) {}
+
+/**
+ * The owner answers the waiting tasks first, see takeWaiting(), or their clients get no reply
+ */
+AdmissionController::~AdmissionController() {
+    qDeleteAll(takeWaiting());
+}
+
+/**
+ * Run a task now, or queue it until its action has a free slot
+ * @return  - false if the action's queue is full, the caller should reject the request
+ */
+bool AdmissionController::submit(RequestTask* task)
+{
+    ActionState& state = getState(task->getAction());
+    if(state.running < state.maxConcurrent)
+    {
+        ++state.running;
+        _pool->start(task, state.priority);
+        return true;
+    }
+
+    if(state.waiting.size() >= state.queueDepth)
+        return false;
+
+    state.waiting.enqueue(task);
+    return true;
+}
+
+/**
+ * A task has finished, give its slot to the next waiting task of the action
+ */
+void AdmissionController::release(const QString& action)
+{
+    ActionState& state = getState(action);
+    if(state.waiting.isEmpty())
+    {
+        state.running = qMax(state.running - 1, 0);
+        return;
+    }
+    _pool->start(state.waiting.dequeue(), state.priority);   // takes over the slot
+}
+
+QList<RequestTask*> AdmissionController::takeWaiting()
+{
+    QList<RequestTask*> result;
+    for(QHash<QString, ActionState>::Iterator it = _states.begin(); it != _states.end(); ++it)
+        while(!it.value().waiting.isEmpty())
+            result << it.value().waiting.dequeue();
+    return result;
+}
+
+/**
+ * @return  - the state of an action, its limits are read from Settings on first use
+ */
+AdmissionController::ActionState& AdmissionController::getState(const QString& action)
+{
+    QHash<QString, ActionState>::Iterator it = _states.find(action);
+    if(it != _states.end())
+        return it.value();
+
+    Settings* settings = Settings::getInstance();
+    ActionState state;
+    state.maxConcurrent = qMax(settings->getMaxConcurrent(action), 1);
+    state.queueDepth    = qMax(settings->getQueueDepth   (action), 0);
+    state.priority      = settings->getPriority(action);
+    state.running       = 0;
+    return _states.insert(action, state).value();
+}
@@ -0,0 +1,44 @@
+﻿#ifndef ADMISSIONCONTROLLER_H
+#define ADMISSIONCONTROLLER_H
+
+#include <QHash>
+#include <QQueue>
+#include <QList>
+#include <QString>
+
+class QThreadPool;
+class RequestTask;
+
+// Decides which requests run, wait, or get turned away, per action
+// Each action may run at most MaxConcurrent tasks at once, and have at most QueueDepth
+// tasks waiting for a slot; beyond that its requests are rejected right away.
+// Admitted tasks enter the thread pool with the action's priority, so that cheap
+// telemetry is picked before expensive profile pages when the pool is busy.
+// Used on the I/O thread only, so no locking
+class AdmissionController
+{
+public:
+    AdmissionController(QThreadPool* pool);
+    ~AdmissionController();                   // deletes the tasks still waiting
+    bool submit (RequestTask* task);          // false if the action is saturated
+    void release(const QString& action);      // a task of the action has finished
+    QList<RequestTask*> takeWaiting();        // all the waiting tasks, e.g., to turn them away on shutdown
+
+private:
+    struct ActionState
+    {
+        int maxConcurrent;
+        int queueDepth;
+        int priority;
+        int running;
+        QQueue<RequestTask*> waiting;
+    };
+
+    ActionState& getState(const QString& action);
+
+private:
+    QThreadPool*                 _pool;
+    QHash<QString, ActionState>  _states;   // action -> state
+};
+
+#endif // ADMISSIONCONTROLLER_H
@@ -0,0 +1,124 @@
+﻿#include "QueryString.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QUrl>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+// Times the parsing of typical request query strings, and the dispatch of their actions:
+// - before: QUrl's pretty decoded string, split on & and =, links and titles decoded again,
+//   and a chain of string compares for the action
+// - after:  QueryString's single pass over the encoded bytes, and a hash of the handlers
+// Usage:
+//     ParserBenchmark [iterations]
+
+static const int DefaultIterations = 200000;
+
+typedef int (*Handler)(const QHash<QString, QString>& params);
+
+// stand-ins for the handlers, which only touch their parameters
+static int ping     (const QHash<QString, QString>& params) { return params.size(); }
+static int save     (const QHash<QString, QString>& params) { return params.value("question").size(); }
+static int logAPI   (const QHash<QString, QString>& params) { return params.value("apisig").size(); }
+static int logAnswer(const QHash<QString, QString>& params) { return params.value("link").size(); }
+static int queryFAQs(const QHash<QString, QString>& params) { return params.value("class").size(); }
+static int personal (const QHash<QString, QString>& params) { return params.value("username").size(); }
+
+static QHash<QString, QString> parseBefore(const QUrl& url)
+{
+    QHash<QString, QString> result;
+    QString query = url.toString();
+    query.remove(0, query.indexOf('?') + 1);
+    foreach(const QString& section, query.split("&"))
+        result.insert(section.section('=', 0,  0),
+                      section.section('=', 1, -1));
+    if(result.contains("link"))
+        result["link"]  = QUrl::fromPercentEncoding(result["link"] .toUtf8());
+    if(result.contains("title"))
+        result["title"] = QUrl::fromPercentEncoding(result["title"].toUtf8());
+    return result;
+}
+
+static int dispatchBefore(const QHash<QString, QString>& params)
+{
+    QString action = params["action"];
+    if(action == "ping")      return ping     (params);
+    if(action == "save")      return save     (params);
+    if(action == "logapi")    return logAPI   (params);
+    if(action == "loganswer") return logAnswer(params);
+    if(action == "query")     return queryFAQs(params);
+    if(action == "personal")  return personal (params);
+    return -1;
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    int iterations = app.arguments().size() > 1 ? app.arguments()[1].toInt() : DefaultIterations;
+
+    QStringList urls;
+    urls << "/?action=query&class=org.eclipse.swt.widgets.Button&username=carl"
+         << "/?action=logapi&username=carl&email=carl%40example.com&apisig=org.eclipse.swt;org.eclipse.swt.widgets.Button.setText(String)"
+         << "/?action=save&username=carl&email=carl%40example.com&apisig=java.util;java.util.List.add(Object)"
+            "&question=How%20to%20add%20an%20element%20%26%20keep%20the%20order%3F"
+            "&link=http%3A%2F%2Fstackoverflow.com%2Fquestions%2F1234%3Fa%3D1&title=Adding%20to%20a%20List"
+         << "/?action=personal&username=carl"
+         << "/?action=ping";
+
+    QList<QUrl>       parsedUrls;   // as the server gets them
+    QList<QByteArray> queries;
+    foreach(const QString& url, urls)
+    {
+        parsedUrls << QUrl(url);
+        queries    << QUrl(url).query(QUrl::FullyEncoded).toLatin1();
+    }
+
+    QHash<QString, Handler> handlers;
+    handlers.insert("ping",      ping);
+    handlers.insert("save",      save);
+    handlers.insert("logapi",    logAPI);
+    handlers.insert("loganswer", logAnswer);
+    handlers.insert("query",     queryFAQs);
+    handlers.insert("personal",  personal);
+
+    int checksum = 0;   // keeps the work from being optimized away
+    QElapsedTimer timer;
+
+    timer.start();
+    for(int i = 0; i < iterations; ++i)
+        checksum += parseBefore(parsedUrls[i % parsedUrls.size()]).size();
+    qint64 parseBeforeNs = timer.nsecsElapsed();
+
+    timer.restart();
+    for(int i = 0; i < iterations; ++i)
+        checksum += QueryString::parse(queries[i % queries.size()]).size();
+    qint64 parseAfterNs = timer.nsecsElapsed();
+
+    QList<QHash<QString, QString> > params;
+    foreach(const QByteArray& query, queries)
+        params << QueryString::parse(query);
+
+    timer.restart();
+    for(int i = 0; i < iterations; ++i)
+        checksum += dispatchBefore(params[i % params.size()]);
+    qint64 dispatchBeforeNs = timer.nsecsElapsed();
+
+    timer.restart();
+    for(int i = 0; i < iterations; ++i)
+    {
+        const QHash<QString, QString>& p = params[i % params.size()];
+        Handler handler = handlers.value(p.value("action"));
+        checksum += handler != 0 ? handler(p) : -1;
+    }
+    qint64 dispatchAfterNs = timer.nsecsElapsed();
+
+    out << "iterations=" << iterations << ", checksum=" << checksum << endl;
+    out << "parse    before " << QString::number(parseBeforeNs    / double(iterations), 'f', 0) << " ns"
+        <<        ", after "  << QString::number(parseAfterNs     / double(iterations), 'f', 0) << " ns" << endl;
+    out << "dispatch before " << QString::number(dispatchBeforeNs / double(iterations), 'f', 0) << " ns"
+        <<        ", after "  << QString::number(dispatchAfterNs  / double(iterations), 'f', 0) << " ns" << endl;
+    return 0;
+}
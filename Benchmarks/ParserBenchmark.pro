@@ -0,0 +1,15 @@
+# Query string parsing and action dispatch, before and after, see ParserBenchmark.cpp
+TARGET = ParserBenchmark
+
+QT -= gui
+
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES = \
+    ParserBenchmark.cpp \
+    ../QueryString.cpp
@@ -0,0 +1,170 @@
+﻿#include "Migrations.h"
+#include "Logger.h"
+
+#include <QCoreApplication>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QVariant>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+// Prints EXPLAIN QUERY PLAN and the mean time of the hot lookups on a database at version 1,
+// then again once migration 2 has indexed the join columns. Usage:
+//     QueryPlanBenchmark [questions]
+// The database is synthetic: 1 question in 3 is a child, each question has an API, an answer,
+// an asker and a reader. It lives in a temporary directory, with the settings and the logs
+
+static const int DefaultQuestions = 20000;
+static const int Runs             = 1000;   // of each lookup
+
+struct Lookup
+{
+    const char* name;
+    const char* sql;   // :key is bound to a random key in [0, keys)
+    int         keys;
+};
+
+static void populate(QSqlDatabase& database, int questions)
+{
+    int users   = qMax(questions / 20, 1);
+    int apis    = qMax(questions / 10, 1);
+    int answers = qMax(questions / 2,  1);
+
+    QSqlQuery query(database);
+    query.exec("begin");
+    query.prepare("insert into Users values (?, ?, ?)");
+    for(int i = 0; i < users; ++i)
+    {
+        query.addBindValue(i);
+        query.addBindValue(QString("user%1").arg(i));
+        query.addBindValue(QString("user%1@example.com").arg(i));
+        query.exec();
+    }
+    query.prepare("insert into APIs values (?, ?)");
+    for(int i = 0; i < apis; ++i)
+    {
+        query.addBindValue(i);
+        query.addBindValue(QString("lib;package.Class%1.method()").arg(i));
+        query.exec();
+    }
+    query.prepare("insert into Answers values (?, ?, ?)");
+    for(int i = 0; i < answers; ++i)
+    {
+        query.addBindValue(i);
+        query.addBindValue(QString("http://example.com/answer%1").arg(i));
+        query.addBindValue(QString("Answer %1").arg(i));
+        query.exec();
+    }
+    for(int i = 0; i < questions; ++i)
+    {
+        query.prepare("insert into Questions values (?, ?, ?, ?)");
+        query.addBindValue(i);
+        query.addBindValue(QString("Question %1?").arg(i));
+        query.addBindValue(1 + i % 7);
+        query.addBindValue(i % 3 == 2 ? i - 1 : -1);
+        query.exec();
+
+        query.prepare("insert into QuestionAboutAPI values (?, ?)");
+        query.addBindValue(i);
+        query.addBindValue(i % apis);
+        query.exec();
+        query.prepare("insert into AnswerToQuestion values (?, ?)");
+        query.addBindValue(i);
+        query.addBindValue(i % answers);
+        query.exec();
+        query.prepare("insert into UserAskQuestion values (?, ?)");
+        query.addBindValue(i);
+        query.addBindValue(i % users);
+        query.exec();
+        query.prepare("insert into UserReadAnswer values (?, ?, ?)");
+        query.addBindValue((i * 7) % users);
+        query.addBindValue(i);
+        query.addBindValue("2015-01-01 00:00:00");
+        query.exec();
+    }
+    query.exec("commit");
+    query.exec("analyze");
+}
+
+static void report(QSqlDatabase& database, const QList<Lookup>& lookups, QTextStream& out)
+{
+    foreach(const Lookup& lookup, lookups)
+    {
+        out << "  " << lookup.name << endl;
+
+        QSqlQuery plan(database);
+        plan.prepare(QString("explain query plan ") + lookup.sql);
+        plan.bindValue(":key", 0);
+        plan.exec();
+        while(plan.next())
+            out << "    " << plan.value(plan.record().count() - 1).toString() << endl;
+
+        QSqlQuery query(database);
+        query.prepare(lookup.sql);
+        QElapsedTimer timer;
+        timer.start();
+        for(int i = 0; i < Runs; ++i)
+        {
+            query.bindValue(":key", (i * 7919) % lookup.keys);
+            query.exec();
+            while(query.next()) {}
+        }
+        out << "    " << QString::number(timer.nsecsElapsed() / 1000.0 / Runs, 'f', 1) << " us" << endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    int questions = app.arguments().size() > 1 ? app.arguments()[1].toInt() : DefaultQuestions;
+
+    QTemporaryDir dir;
+    QDir::setCurrent(dir.path());
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE");
+        database.setDatabaseName("FAQs.db");
+        if(!database.open() || !Migrations::run(database, 1))
+        {
+            out << "failed to create the database" << endl;
+            return 1;
+        }
+        populate(database, questions);
+
+        QList<Lookup> lookups;
+        Lookup leads   = {"lead questions of an API",
+                          "select Q.ID from QuestionAboutAPI R, Questions Q \
+                           where R.APIID = :key and Q.ID = R.QuestionID and Q.Parent = -1",
+                          qMax(questions / 10, 1)};
+        Lookup group   = {"questions of a group",
+                          "select ID from Questions where Parent = :key", questions};
+        Lookup answer  = {"questions of an answer",
+                          "select QuestionID from AnswerToQuestion where AnswerID = :key", qMax(questions / 2, 1)};
+        Lookup user    = {"questions of a user",
+                          "select QuestionID from UserAskQuestion where UserID = :key", qMax(questions / 20, 1)};
+        Lookup readers = {"readers of a question",
+                          "select UserID from UserReadAnswer where QuestionID = :key", questions};
+        lookups << leads << group << answer << user << readers;
+
+        out << "questions=" << questions << ", runs=" << Runs << endl;
+        out << "version 1" << endl;
+        report(database, lookups, out);
+
+        if(!Migrations::run(database, 2))
+        {
+            out << "failed to migrate to version 2" << endl;
+            return 1;
+        }
+        QSqlQuery(database).exec("analyze");
+        out << "version 2" << endl;
+        report(database, lookups, out);
+        database.close();
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+    Logger::getInstance()->stop();
+    return 0;
+}
@@ -0,0 +1,19 @@
+# Query plans and timings of the hot lookups before and after migration 2, see QueryPlanBenchmark.cpp
+TARGET = QueryPlanBenchmark
+
+QT += sql
+QT -= gui
+
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES = \
+    QueryPlanBenchmark.cpp \
+    ../Migrations.cpp \
+    ../EventLog.cpp \
+    ../Settings.cpp \
+    ../Logger.cpp
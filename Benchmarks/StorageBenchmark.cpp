@@ -0,0 +1,106 @@
+﻿#include "DAO.h"
+#include "Settings.h"
+#include "Logger.h"
+#include "WriteEvent.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QProcess>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <cstdio>
+
+// Replays N save events through DAO, in batches like the writer thread, under each storage profile
+// Each profile runs in a child process, in a new directory, so that it starts from an empty
+// database and its own FAQsServer.ini. Usage:
+//     StorageBenchmark [events]                          all the profiles
+//     StorageBenchmark --run synchronous cacheKiB events  one profile, in the current directory
+
+static const int DefaultEvents = 5000;
+
+/**
+ * Saves by 100 users about 50 APIs, a quarter of them asking an earlier question again
+ */
+static QList<WriteEvent> createEvents(int count)
+{
+    QList<WriteEvent> events;
+    for(int i = 0; i < count; ++i)
+    {
+        WriteEvent event;
+        event.type     = WriteEvent::Save;
+        event.userName = QString("user%1").arg(i % 100);
+        event.email    = event.userName + "@example.com";
+        event.apiSig   = QString("java.util;List%1.add(Object)").arg(i % 50);
+        event.question = QString("How do I use add %1?").arg(i % 4 == 0 ? i / 8 : i);
+        event.link     = QString("http://example.com/answer%1").arg(i % 500);
+        event.title    = QString("Answer %1").arg(i % 500);
+        events << event;
+    }
+    return events;
+}
+
+/**
+ * @return  - events per second
+ */
+static double runProfile(const QString& synchronous, int cacheSize, int count)
+{
+    Settings* settings = Settings::getInstance();
+    settings->setDBSynchronous(synchronous);
+    settings->setDBCacheSize(cacheSize);
+    settings->setFAQGraph(false);   // the database only
+
+    QList<WriteEvent> events = createEvents(count);
+    DAO* dao = DAO::getInstance();
+    int batchSize = settings->getWriteBatchSize();
+
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0; i < events.size(); i += batchSize)
+    {
+        dao->beginTransaction();
+        for(int j = i; j < qMin(i + batchSize, events.size()); ++j)
+            dao->apply(events[j]);
+        if(!dao->commit())
+            dao->rollback();
+    }
+    double seconds = timer.nsecsElapsed() / 1e9;
+    dao->closeDatabase();
+    return seconds > 0 ? count / seconds : 0;
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    QTextStream out(stdout);
+
+    if(args.size() == 5 && args[1] == "--run")
+    {
+        double rate = runProfile(args[2], args[3].toInt(), args[4].toInt());
+        Logger::getInstance()->stop();
+        out << QString::number(rate, 'f', 0) << endl;
+        return 0;
+    }
+
+    int count = args.size() > 1 ? args[1].toInt() : DefaultEvents;
+    QStringList synchronousModes = QStringList() << "off" << "normal" << "full";
+    QList<int>  cacheSizes       = QList<int>()  << 2000 << 8192 << 65536;
+
+    out << "events=" << count << endl;   // no Settings here, it would create FAQsServer.ini
+    out << "synchronous\tcache KiB\tevents/s" << endl;
+    foreach(const QString& synchronous, synchronousModes)
+        foreach(int cacheSize, cacheSizes)
+        {
+            QTemporaryDir dir;
+            QProcess process;
+            process.setWorkingDirectory(dir.path());
+            process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+            process.start(app.applicationFilePath(), QStringList() << "--run" << synchronous
+                          << QString::number(cacheSize) << QString::number(count));
+            process.waitForFinished(-1);
+            QString rate = QString::fromLatin1(process.readAllStandardOutput()).trimmed();
+            out << synchronous << "\t\t" << cacheSize << "\t\t" << (rate.isEmpty() ? "failed" : rate) << endl;
+        }
+    return 0;
+}
@@ -0,0 +1,30 @@
+# Write throughput of DAO under each storage profile, see StorageBenchmark.cpp
+TARGET = StorageBenchmark
+
+QT += network sql
+QT -= gui
+
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES = \
+    StorageBenchmark.cpp \
+    ../DAO.cpp \
+    ../SimilarityComparer.cpp \
+    ../Settings.cpp \
+    ../Metrics.cpp \
+    ../Logger.cpp \
+    ../Tracer.cpp \
+    ../Migrations.cpp \
+    ../SignatureIndex.cpp \
+    ../RelatedUsersGraph.cpp \
+    ../FAQGraph.cpp \
+    ../EventLog.cpp \
+    ../QuestionGroups.cpp
+HEADERS = \
+    ../DAO.h \
+    ../SimilarityComparer.h
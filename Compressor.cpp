@@ -0,0 +1,136 @@
+﻿#include "Compressor.h"
+#include "Reply.h"
+
+#include <QStringList>
+
+/**
+ * Choose a content coding from the Accept-Encoding header of a request
+ * e.g., "gzip, deflate" -> gzip; "deflate;q=1, gzip;q=0.5" -> deflate; "br" -> identity
+ * @return  - "gzip", "deflate", or an empty string for no compression
+ */
+QString Compressor::negotiate(const QString& acceptEncoding)
+{
+    QString best;
+    double  bestQ = 0.0;
+    foreach(const QString& item, acceptEncoding.split(',', QString::SkipEmptyParts))
+    {
+        QString coding = item.section(';', 0, 0).trimmed().toLower();
+        QString param  = item.section(';', 1, 1).trimmed().toLower();
+        double  q      = param.startsWith("q=") ? param.mid(2).toDouble() : 1.0;
+        if(coding == "*")
+            coding = "gzip";
+        if(coding != "gzip" && coding != "deflate")
+            continue;
+
+        // gzip wins ties, some old clients get raw deflate wrong
+        if(q > bestQ || (q == bestQ && q > 0 && coding == "gzip"))
+        {
+            best  = coding;
+            bestQ = q;
+        }
+    }
+    return best;
+}
+
+/**
+ * Whether a type is worth compressing. Images are compressed already
+ */
+bool Compressor::isCompressible(const QString& mimeType)
+{
+    return mimeType.startsWith("text/")          ||
+           mimeType.contains  ("json")           ||
+           mimeType.contains  ("xml")            ||
+           mimeType.contains  ("javascript");
+}
+
+QByteArray Compressor::encode(const QByteArray& data, const QString& coding)
+{
+    if(coding == "gzip")
+        return gzip(data);
+    if(coding == "deflate")
+        return deflate(data);
+    return data;
+}
+
+/**
+ * HTTP deflate is a zlib stream, i.e., qCompress's output without its 4-byte length prefix
+ */
+QByteArray Compressor::deflate(const QByteArray& data) {
+    return qCompress(data).mid(4);
+}
+
+/**
+ * gzip (RFC 1952): a 10-byte header, the raw deflate data, CRC-32 and size
+ * The raw data is qCompress's zlib stream without its 2-byte header and 4-byte Adler-32
+ */
+QByteArray Compressor::gzip(const QByteArray& data)
+{
+    QByteArray zlib = qCompress(data);
+    if(zlib.size() < 10)
+        return QByteArray();
+
+    static const char header[] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, 3};  // deflate, no flags, no mtime, unix
+    QByteArray result(header, sizeof(header));
+    result.reserve(sizeof(header) + zlib.size());
+    result.append(zlib.constData() + 6, zlib.size() - 10);
+
+    quint32 crc  = crc32(data);
+    quint32 size = static_cast<quint32>(data.size());
+    for(int i = 0; i < 4; ++i)
+        result.append(static_cast<char>((crc  >> (8 * i)) & 0xff));  // little endian
+    for(int i = 0; i < 4; ++i)
+        result.append(static_cast<char>((size >> (8 * i)) & 0xff));
+    return result;
+}
+
+// CRC-32 of each byte value
+struct CRCTable
+{
+    CRCTable()
+    {
+        for(quint32 i = 0; i < 256; ++i)
+        {
+            quint32 c = i;
+            for(int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+    quint32 entries[256];
+};
+
+quint32 Compressor::crc32(const QByteArray& data)
+{
+    static const CRCTable table;   // initialized once, thread safe since C++11
+
+    quint32 crc = 0xffffffffu;
+    const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+    for(int i = 0; i < data.size(); ++i)
+        crc = table.entries[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+/**
+ * Compress the body of a dynamic reply in place
+ * @param reply             - the reply
+ * @param acceptEncoding    - Accept-Encoding header of the request
+ * @param threshold         - bodies smaller than this (bytes) are sent as is
+ */
+void Compressor::compress(Reply& reply, const QString& acceptEncoding, int threshold)
+{
+    if(reply.body.size() < threshold || reply.headers.contains("Content-Encoding") ||
+       !isCompressible(reply.headers.value("Content-Type")))
+        return;
+
+    reply.headers.insert("Vary", "Accept-Encoding");
+    QString coding = negotiate(acceptEncoding);
+    if(coding.isEmpty())
+        return;
+
+    QByteArray encoded = encode(reply.body, coding);
+    if(encoded.isEmpty() || encoded.size() >= reply.body.size())
+        return;
+
+    reply.body = encoded;
+    reply.headers.insert("Content-Encoding", coding);
+}
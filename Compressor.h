@@ -0,0 +1,26 @@
+﻿#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <QByteArray>
+#include <QString>
+
+struct Reply;
+
+// HTTP content coding (gzip, deflate) on top of qCompress, i.e., Qt's zlib
+class Compressor
+{
+public:
+    static QString    negotiate(const QString& acceptEncoding);  // "gzip", "deflate", or empty for identity
+    static bool       isCompressible(const QString& mimeType);
+    static QByteArray encode (const QByteArray& data, const QString& coding);
+    static QByteArray gzip   (const QByteArray& data);
+    static QByteArray deflate(const QByteArray& data);
+
+    // compress the body of a reply if it is large enough and the client accepts it
+    static void compress(Reply& reply, const QString& acceptEncoding, int threshold);
+
+private:
+    static quint32 crc32(const QByteArray& data);
+};
+
+#endif // COMPRESSOR_H
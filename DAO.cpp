@@ -1,6 +1,17 @@
 ﻿#include "DAO.h"
 #include "SimilarityComparer.h"
 #include "Settings.h"
+#include "WriteEvent.h"
+#include "Metrics.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "IDAllocator.h"
+#include "Migrations.h"
+#include "SignatureIndex.h"
+#include "RelatedUsersGraph.h"
+#include "FAQGraph.h"
+#include "EventLog.h"
+#include "QuestionGroups.h"
 
 #include <QSqlDatabase>
 #include <QSqlQuery>
@@ -8,81 +19,439 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
-#include <QDebug>
 #include <QStringList>
 #include <QDateTime>
 #include <QSettings>
+#include <QSet>
+#include <QThread>
+#include <QThreadStorage>
+#include <QThreadPool>
+#include <QRunnable>
+#include <cstdlib>
+
+// A cached prepared query, finished when it goes out of scope, so that an unfinished
+// select does not keep its connection's read transaction, and snapshot, open
+class Statement
+{
+public:
+    Statement(QSqlQuery* query) : _query(query) {}
+    ~Statement() { _query->finish(); }
+    QSqlQuery& operator* () const { return *_query; }
+    QSqlQuery* operator->() const { return  _query; }
+
+private:
+    QSqlQuery* _query;
+};
+
+// prepared queries of each thread's connection, statement -> query
+static QThreadStorage<QHash<QString, QSqlQuery*>*> statements;
+
+// # of nested transactions open on each thread's connection
+static QThreadStorage<int> transactionDepth;
+
+// # of statements that failed on each thread's connection, for a batch to tell its failed events
+static QThreadStorage<int> failedStatements;
+
+// history events of each thread's open transaction, appended to the event log on commit
+struct PendingEvents
+{
+    QList<EventLog::Event> events;
+    QVector<int>           marks;   // # of events when each nested transaction began
+};
+static QThreadStorage<PendingEvents*> pendingEvents;
+
+static PendingEvents* getPendingEvents()
+{
+    if(!pendingEvents.hasLocalData())
+        pendingEvents.setLocalData(new PendingEvents);
+    return pendingEvents.localData();
+}
 
-DAO* DAO::_instance = 0;
+// A transaction, or a savepoint inside one, rolled back when it goes out of scope uncommitted
+class Transaction
+{
+public:
+    Transaction(DAO* dao) : _dao(dao), _open(dao->beginTransaction()) {}
+    ~Transaction()
+    {
+        if(_open)
+            _dao->rollback();
+    }
+
+    bool isOpen() const { return _open; }
+
+    bool commit()
+    {
+        if(!_open || !_dao->commit())
+            return false;
+        _open = false;
+        return true;
+    }
+
+private:
+    DAO* _dao;
+    bool _open;
+};
+
+// Loads the signature index in the background, so that starting up does not wait for it
+// Until it is loaded, queryFAQs falls back to LIKE
+class SignatureLoader : public QRunnable
+{
+public:
+    SignatureLoader(DAO* dao) : _dao(dao) {}
+
+    void run()
+    {
+        _dao->updateSignatureIndex(-1);   // all of them, DAO may have indexed newer ones already
+        _dao->_signatureIndex->setLoaded();
+        _dao->closeDatabase();            // of the pool's thread
+        LOG_INFO("dao", QObject::tr("signature index loaded, watermark %1").arg(_dao->_signatureIndex->getWatermark()));
+    }
+
+private:
+    DAO* _dao;
+};
 
 DAO* DAO::getInstance()
 {
-    if(_instance == 0)
-        _instance = new DAO;
-    return _instance;
+    static DAO* instance = new DAO;
+    return instance;
 }
 
 DAO::DAO()
 {
-    QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE");
-    database.setDatabaseName("FAQs.db");
-    database.open();
-
-    QSqlQuery query;
-    query.exec("create table APIs ( \
-               ID        int primary key, \
-               Signature varchar unique not null)");    // e.g., lib;package.class.method
-    query.exec("create table Answers ( \
-               ID    int primary key, \
-               Link  varchar unique not null, \
-               Title varchar        not null)");
-    query.exec("create table Users ( \
-               ID    int primary key, \
-               Name  varchar unique not null, \
-               Email varchar unique)");
-    query.exec("create table Questions ( \
-               ID         int primary key, \
-               Question   varchar unique not null, \
-               AskCount   int, \
-               Parent     int)");
-    query.exec("create table UserAskQuestion ( \
-               QuestionID int references Questions(ID) on delete cascade on update cascade, \
-               UserID     int references Users    (ID) on delete cascade on update cascade, \
-               primary key (QuestionID, UserID))");
-    query.exec("create table QuestionAboutAPI ( \
-               QuestionID int references Questions(ID) on delete cascade on update cascade, \
-               APIID      int references APIs     (ID) on delete cascade on update cascade, \
-               primary key (QuestionID, APIID))");
-    query.exec("create table AnswerToQuestion ( \
-               QuestionID int references Questions(ID) on delete cascade on update cascade, \
-               AnswerID   int references Answers  (ID) on delete cascade on update cascade, \
-               primary key (QuestionID, AnswerID))");
-    query.exec("create table UserReadDocument ( \
-               UserID int references Users(ID) on delete cascade on update cascade, \
-               APIID  int references APIs (ID) on delete cascade on update cascade, \
-               Time   varchar, \
-               primary key (UserID, APIID, Time))");
-    query.exec("create table UserReadAnswer ( \
-                UserID     int references Users    (ID) on delete cascade on update cascade, \
-                QuestionID int references Questions(ID) on delete cascade on update cascade, \
-                Time       varchar, \
-                primary key (UserID, QuestionID, Time))");
+    // the rest of DAO expects the latest schema, a half migrated one would fail statement by statement
+    if(!Migrations::run(getDatabase()))
+    {
+        LOG_ERROR("dao", tr("failed to migrate the database, not serving"));
+        Logger::getInstance()->stop();
+        ::exit(1);   // under Supervisor, the worker is restarted and tries again
+    }
+
+    QStringList tables;
+    tables << "APIs" << "Answers" << "Users" << "Questions";
+    foreach(const QString& table, tables)
+    {
+        _idAllocators.insert(table, new IDAllocator);
+        seedID(table);
+    }
+
+    _signatureIndex = new SignatureIndex;
+    QThreadPool::globalInstance()->start(new SignatureLoader(this));
+
+    _relatedUsers = new RelatedUsersGraph;
+    loadRelatedUsers();
+
+    _questionGroups = new QuestionGroups;
+
+    // the graph must see every write, so it serves the queries only if this is the only process
+    _graph = 0;
+    Settings* settings = Settings::getInstance();
+    if(settings->getFAQGraph() && settings->getProcesses() == 1)
+    {
+        _graph = new FAQGraph;
+        if(_graph->load(getDatabase()))
+            LOG_INFO("dao", tr("queries are answered in memory"));
+        else
+        {
+            LOG_ERROR("dao", tr("failed to load the FAQ graph, queries are answered by the database"));
+            delete _graph;
+            _graph = 0;
+        }
+    }
 
     _comparer = new SimilarityComparer(this);
     connect(_comparer, SIGNAL(comparisonResult  (QString,QString,qreal)),
             this,      SLOT  (onComparisonResult(QString,QString,qreal)));
 }
 
+QString DAO::getConnectionName() const {
+    return tr("FAQs-%1").arg(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+}
+
 /**
- * @return  - a new ID for a given table. ID starts from 0
+ * A connection can only be used by the thread that created it,
+ * so each thread (I/O, workers) gets its own connection to the database
+ * @return  - the database connection of the current thread
  */
-int DAO::getNextID(const QString& tableName) const
+QSqlDatabase DAO::getDatabase() const
 {
-    if(tableName.isEmpty())
-        return 0;
-    QSqlQuery query;
-    query.exec(tr("select max(ID) from %1").arg(tableName));
-    return query.next() ? query.value(0).toInt() + 1 : 0;
+    QString name = getConnectionName();
+    if(QSqlDatabase::contains(name))
+        return QSqlDatabase::database(name);
+
+    QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", name);
+    database.setDatabaseName("FAQs.db");
+    database.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");   // wait for other connections' writes
+    if(!database.open())
+        return database;
+
+    // storage profile
+    // WAL: readers, in any process, don't block the writer, nor it them
+    // with WAL, synchronous = normal only syncs at checkpoints, a crash may lose the last
+    // transactions but never corrupts the database
+    Settings* settings = Settings::getInstance();
+    QString synchronous = settings->getDBSynchronous().toLower();
+    if(!QStringList(QStringList() << "off" << "normal" << "full" << "extra").contains(synchronous))
+        synchronous = "normal";
+    QSqlQuery query(database);
+    query.exec("pragma journal_mode = wal");
+    query.exec("pragma synchronous = " + synchronous);
+    query.exec(tr("pragma cache_size = %1").arg(-settings->getDBCacheSize()));   // negative: in KiB
+    query.exec(tr("pragma mmap_size = %1") .arg(settings->getDBMmapSize()));
+    return database;
+}
+
+void DAO::closeDatabase()
+{
+    if(statements.hasLocalData() && statements.localData() != 0)
+    {
+        qDeleteAll(*statements.localData());
+        statements.setLocalData(0);
+    }
+    transactionDepth.setLocalData(0);   // closing rolls back whatever is open
+    pendingEvents.setLocalData(0);
+
+    QString name = getConnectionName();
+    if(!QSqlDatabase::contains(name))
+        return;
+    QSqlDatabase::database(name).close();
+    QSqlDatabase::removeDatabase(name);
+}
+
+/**
+ * Get the prepared query of a statement on the current thread's connection
+ * A statement is parsed and planned once per connection, then only its values are bound.
+ * Use it through a Statement, and don't nest two uses of the same statement
+ * @param sql   - the statement, with placeholders for all its values
+ */
+QSqlQuery* DAO::prepare(const QString& sql) const
+{
+    if(!statements.hasLocalData() || statements.localData() == 0)
+        statements.setLocalData(new QHash<QString, QSqlQuery*>);
+
+    QHash<QString, QSqlQuery*>* cache = statements.localData();
+    QSqlQuery* query = cache->value(sql);
+    if(query == 0)
+    {
+        query = new QSqlQuery(getDatabase());
+        query->prepare(sql);
+        cache->insert(sql, query);
+    }
+    return query;
+}
+
+/**
+ * Execute a prepared statement, timing it in the sql stage histogram
+ */
+bool DAO::exec(QSqlQuery& query) const
+{
+    static const int histogram = Metrics::getInstance()->getHistogram("faqs_stage_duration_seconds", "stage=\"sql\"");
+    LatencyTimer timer(histogram);
+    TRACE_SPAN_DETAIL("sql", query.lastQuery());
+    if(query.exec())
+        return true;
+    failedStatements.setLocalData(failedStatements.localData() + 1);
+    return false;
+}
+
+/**
+ * Transactions nest: the outermost one is a BEGIN IMMEDIATE transaction, which takes the write
+ * lock upfront, so it never fails halfway when upgrading from read to write.
+ * The inner ones are savepoints, so e.g., apply() is atomic by itself and within a batch
+ */
+bool DAO::beginTransaction()
+{
+    int depth = transactionDepth.localData();
+    QSqlQuery query(getDatabase());
+    if(!query.exec(depth == 0 ? QString("begin immediate") : tr("savepoint level%1").arg(depth)))
+        return false;
+    transactionDepth.setLocalData(depth + 1);
+    getPendingEvents()->marks << getPendingEvents()->events.size();
+    return true;
+}
+
+/**
+ * A failed commit leaves the transaction open, for the caller to roll back
+ */
+bool DAO::commit()
+{
+    int depth = transactionDepth.localData();
+    if(depth == 0)
+        return false;
+    QSqlQuery query(getDatabase());
+    if(!query.exec(depth == 1 ? QString("commit") : tr("release level%1").arg(depth - 1)))
+        return false;
+    transactionDepth.setLocalData(depth - 1);
+
+    PendingEvents* pending = getPendingEvents();
+    pending->marks.removeLast();
+    if(depth == 1)
+    {
+        foreach(const EventLog::Event& event, pending->events)
+            EventLog::getInstance()->append(event);
+        pending->events.clear();
+    }
+    return true;
+}
+
+bool DAO::rollback()
+{
+    int depth = transactionDepth.localData();
+    if(depth == 0)
+        return false;
+    transactionDepth.setLocalData(depth - 1);
+
+    // the events of the transaction are dropped with it
+    PendingEvents* pending = getPendingEvents();
+    if(!pending->marks.isEmpty())
+        pending->events = pending->events.mid(0, pending->marks.takeLast());
+
+    QSqlQuery query(getDatabase());
+    bool ok = depth == 1 ? query.exec("rollback")
+                         : query.exec(tr("rollback to level%1").arg(depth - 1)) &&
+                           query.exec(tr("release level%1")    .arg(depth - 1));
+
+    // so are its changes to the groups, which may be ahead of GroupChanges now: -1, reload
+    // them on the next write, as persistGroups does when it fails
+    _questionGroups->setVersion(-1);
+    return ok;
+}
+
+/**
+ * Make the next ID of a table greater than any ID in it. IDs start from 0
+ */
+void DAO::seedID(const QString& tableName)
+{
+    Statement query(prepare(tr("select max(ID) from %1").arg(tableName)));
+    exec(*query);
+    if(query->next() && !query->value(0).isNull())
+        _idAllocators.value(tableName)->raise(query->value(0).toInt() + 1);
+}
+
+/**
+ * Insert a row with a newly allocated ID
+ * If the ID is taken, e.g., by another process, the allocator is reseeded and the insert retried,
+ * as long as it's the ID that collides. Each reseed moves past max(ID), so it ends
+ * unless other processes keep inserting ahead of it
+ * @param query - a prepared insert, with all but :id bound
+ * @return      - the new row's ID, or -1 if the insert failed, e.g., the row exists already
+ */
+int DAO::insertWithNewID(const QString& tableName, QSqlQuery& query)
+{
+    const int maxAttempts = 100;
+    for(int attempt = 0; attempt < maxAttempts; ++attempt)
+    {
+        int id = _idAllocators.value(tableName)->allocate();
+        query.bindValue(":id", id);
+        int failed = failedStatements.localData();
+        if(exec(query))
+            return id;
+
+        // any other failure, e.g., the natural key exists, is the caller's
+        // either way the failed insert is handled, and not an error of the transaction
+        Statement taken(prepare(tr("select 1 from %1 where ID = :id").arg(tableName)));
+        taken->bindValue(":id", id);
+        if(!exec(*taken))
+            return -1;
+        failedStatements.setLocalData(failed);
+        if(!taken->next())
+            return -1;
+        seedID(tableName);
+    }
+    LOG_ERROR("dao", tr("no free ID in %1 after %2 attempts").arg(tableName).arg(maxAttempts));
+    return -1;
+}
+
+/**
+ * Add the APIs with rowid > afterRowID to the signature index
+ * Other processes may insert APIs too, in any order of their IDs, but rowids grow as they commit
+ */
+void DAO::updateSignatureIndex(qint64 afterRowID) const
+{
+    Statement query(prepare("select rowid, ID, Signature from APIs where rowid > :after order by rowid"));
+    query->bindValue(":after", afterRowID);
+    exec(*query);
+    qint64 watermark = afterRowID;
+    while(query->next())
+    {
+        _signatureIndex->insert(query->value(1).toInt(), query->value(2).toString());
+        watermark = query->value(0).toLongLong();
+    }
+    _signatureIndex->setWatermark(watermark);
+}
+
+static const QString RelatedUsersSnapshot = "RelatedUsers.snapshot";
+
+/**
+ * Load the related users graph from its snapshot, or build it from the aggregates if there is none,
+ * then bring it up to date
+ */
+void DAO::loadRelatedUsers()
+{
+    if(!_relatedUsers->load(RelatedUsersSnapshot))
+    {
+        // one statement, so that the edges and the watermark are of the same snapshot of the database
+        Statement query(prepare("select UserID, OtherID, Shared, (select max(rowid) from UserQuestions) \
+                                 from UserRelated where UserID < OtherID"));
+        exec(*query);
+        while(query->next())
+        {
+            _relatedUsers->addEdge(query->value(0).toInt(), query->value(1).toInt(), query->value(2).toInt());
+            _relatedUsers->setWatermark(query->value(3).toLongLong());
+        }
+        LOG_INFO("dao", tr("related users rebuilt from the database"));
+    }
+    updateRelatedUsers();
+}
+
+/**
+ * Replay the UserQuestions rows added since the graph's watermark, by this process or others
+ * A user's new question relates her to each user who had it before
+ */
+void DAO::updateRelatedUsers() const
+{
+    QMutexLocker locker(&_relatedUsersMutex);
+
+    QList<QPair<qint64, QPair<int, int> > > events;   // rowid -> (user ID, question ID)
+    {
+        Statement query(prepare("select rowid, UserID, QuestionID from UserQuestions where rowid > :mark order by rowid"));
+        query->bindValue(":mark", _relatedUsers->getWatermark());
+        exec(*query);
+        while(query->next())
+            events << qMakePair(query->value(0).toLongLong(),
+                                qMakePair(query->value(1).toInt(), query->value(2).toInt()));
+    }
+
+    for(int i = 0; i < events.size(); ++i)
+    {
+        int userID = events[i].second.first;
+        Statement query(prepare("select UserID from UserQuestions \
+                                 where QuestionID = :question and rowid < :row and UserID != :user"));
+        query->bindValue(":question", events[i].second.second);
+        query->bindValue(":row",      events[i].first);
+        query->bindValue(":user",     userID);
+        exec(*query);
+        while(query->next())
+            _relatedUsers->addEdge(userID, query->value(0).toInt());
+    }
+    if(!events.isEmpty())
+        _relatedUsers->setWatermark(events.last().first);
+}
+
+void DAO::compactHistory() {
+    EventLog::getInstance()->compact();
+}
+
+void DAO::flushHistory() {
+    EventLog::getInstance()->flush();
+}
+
+void DAO::saveSnapshots()
+{
+    QMutexLocker locker(&_relatedUsersMutex);
+    if(!_relatedUsers->save(RelatedUsersSnapshot))
+        LOG_WARNING("dao", tr("failed to save %1").arg(RelatedUsersSnapshot));
 }
 
 /**
@@ -94,12 +463,11 @@ int DAO::getNextID(const QString& tableName) const
  */
 int DAO::getID(const QString& tableName, const QString& section, const QString& value) const
 {
-    QSqlQuery query;
-    query.prepare(tr("select ID from %1 where %2 = :value").arg(tableName)
-                                                           .arg(section));
-    query.bindValue(":value", value);
-    query.exec();
-    return query.next() ? query.value(0).toInt() : -1;
+    Statement query(prepare(tr("select ID from %1 where %2 = :value").arg(tableName)
+                                                                     .arg(section)));
+    query->bindValue(":value", value);
+    exec(*query);
+    return query->next() ? query->value(0).toInt() : -1;
 }
 int DAO::getUserID    (const QString& userName)  const { return getID("Users",     "Name",      userName); }
 int DAO::getAPIID     (const QString& signature) const { return getID("APIs",      "Signature", signature); }
@@ -109,69 +477,91 @@ int DAO::getAnswerID  (const QString& link)      const { return getID("Answers",
 /**
  * Write an API to db
  * @param signature
+ * @return  - ID of the API, -1 if signature is empty
  */
-void DAO::updateAPI(const QString& signature)
+int DAO::updateAPI(const QString& signature)
 {
-    if(signature.isEmpty() || getAPIID(signature) >= 0)
-        return;
-
-    QSqlQuery query;
-    query.prepare("insert into APIs values (:id, :sig)");   // let it fail if the API exists, because APIs don't change
-    query.bindValue(":id",  getNextID("APIs"));
-    query.bindValue(":sig", signature);
-    query.exec();
+    if(signature.isEmpty())
+        return -1;
+    int id = getAPIID(signature);
+    if(id >= 0)   // APIs don't change
+        return id;
+
+    Statement query(prepare("insert into APIs values (:id, :sig)"));
+    query->bindValue(":sig", signature);
+    id = insertWithNewID("APIs", *query);
+    if(id < 0)
+        return getAPIID(signature);   // another thread may have inserted it meanwhile
+
+    // if the transaction rolls back, the index keeps an ID with no questions, which finds nothing
+    _signatureIndex->insert(id, signature);
+    return id;
 }
 
 /**
  * Update Users table
+ * @return  - ID of the user, -1 if userName is empty
  */
-void DAO::updateUser(const QString& userName, const QString& email)
+int DAO::updateUser(const QString& userName, const QString& email)
 {
     if(userName.isEmpty())
-        return;
+        return -1;
 
     // update existing user or insert a new one
-    QSqlQuery query;
     int id = getUserID(userName);
-    if(id > 0) {
-        query.prepare("update Users set Name = :name, Email = :email where ID = :id");
-        query.bindValue(":id", id);
-    }
-    else {
-        query.prepare("insert into Users values (:id, :name, :email)");
-        query.bindValue(":id", getNextID("Users"));
+    if(id >= 0)
+    {
+        Statement query(prepare("update Users set Email = :email where ID = :id and Email is not :old"));
+        query->bindValue(":id",    id);
+        query->bindValue(":email", email);
+        query->bindValue(":old",   email);
+        exec(*query);
+        if(query->numRowsAffected() > 0)   // shown as the user of her questions
+            invalidateUser(id);
+        return id;
     }
-    query.bindValue(":name",  userName);
-    query.bindValue(":email", email);
-    query.exec();
+
+    Statement query(prepare("insert into Users values (:id, :name, :email)"));
+    query->bindValue(":name",  userName);
+    query->bindValue(":email", email);
+    id = insertWithNewID("Users", *query);
+    return id >= 0 ? id : getUserID(userName);
 }
 
 /**
  * Update Questions table
+ * @return  - ID of the question, -1 if question is empty
  */
-void DAO::updateQuestion(const QString& question, int apiID)
+int DAO::updateQuestion(const QString& question, int apiID)
 {
     if(question.isEmpty())
-        return;
+        return -1;
 
-    // update the ask count of the existing question
-    QSqlQuery query;
+    syncGroups();
+
+    // update the ask count of the existing question, it may now lead its group
     int questionID = getQuestionID(question);
     if(questionID >= 0)
     {
-        query.exec(tr("update Questions set AskCount = AskCount + 1 where ID = %1")
-                   .arg(questionID));
-        updateLead(questionID);
-        return;
+        Statement query(prepare("update Questions set AskCount = AskCount + 1 where ID = :id"));
+        query->bindValue(":id", questionID);
+        exec(*query);
+        _questionGroups->ask(questionID);
+        persistGroups();
+        return questionID;
     }
 
     // or insert a new question
-    query.prepare("insert into Questions values (:id, :question, 1, -1)");
-    query.bindValue(":id",       getNextID("Questions"));
-    query.bindValue(":question", question);
-    query.exec();
+    Statement query(prepare("insert into Questions values (:id, :question, 1, -1)"));
+    query->bindValue(":question", question);
+    questionID = insertWithNewID("Questions", *query);
+    if(questionID < 0)
+        return getQuestionID(question);
+    _questionGroups->add(questionID);
+    persistGroups();
 
     measureSimilarity(question, apiID);  // initiate measure
+    return questionID;
 }
 
 /**
@@ -182,13 +572,17 @@ void DAO::updateQuestion(const QString& question, int apiID)
 void DAO::measureSimilarity(const QString& question, int apiID)
 {
     // find the lead questions the API has
-    QSqlQuery query;
-    query.exec(tr("select Question from QuestionAboutAPI, Questions\
-                   where APIID = %1 and QuestionID = ID and Parent = -1").arg(apiID));
+    Statement query(prepare("select Question from QuestionAboutAPI, Questions \
+                             where APIID = :api and QuestionID = ID and Parent = -1"));
+    query->bindValue(":api", apiID);
+    exec(*query);
 
     // compare this question with each lead question
-    while(query.next())
-        _comparer->compare(query.value(0).toString(), question);
+    // the comparer works on the thread that owns DAO, and this may be a worker thread
+    while(query->next())
+        QMetaObject::invokeMethod(_comparer, "compare", Qt::QueuedConnection,
+                                  Q_ARG(QString, query->value(0).toString()),
+                                  Q_ARG(QString, question));
 }
 
 /**
@@ -204,76 +598,127 @@ void DAO::onComparisonResult(const QString& leadQuestion,
     if(similarity <= threshold)
         return;
 
-    // set lead question to be the parent of question if similar
-    QSqlQuery query;
-    query.exec(tr("update Questions set Parent = %1 where ID = %2")
-               .arg(getQuestionID(leadQuestion))
-               .arg(getQuestionID(question)));
+    // the question's group joins the lead's if similar
+    Transaction transaction(this);
+    if(!transaction.isOpen())
+        return;
+    syncGroups();
+    int questionID = getQuestionID(question);
+    if(!_questionGroups->merge(getQuestionID(leadQuestion), questionID))
+        return;
+    persistGroups();
+    invalidateQuestion(questionID);   // it was shown on its own, now it's part of the lead's group
+    if(transaction.commit() && _graph != 0)
+        _graph->merge(leadQuestion, question);
 }
 
 /**
- * Update the lead of a group once a question is being asked one more time
- * The lead of a similar-meaning question group is the one with highest ask count
- * @param questionID    - id of the question being updated
+ * The groups are only changed by writers, in their write transactions, which log the questions
+ * whose rows they changed in GroupChanges. Changes after the groups' version are another
+ * process's; only their questions are re-read. All of them are, if the groups are further
+ * behind than GroupChanges goes back, or a transaction that changed them rolled back.
+ * Call it in the transaction, before the change
  */
-void DAO::updateLead(int questionID)
+void DAO::syncGroups()
 {
-    // get lead id and this question's ask count
-    QSqlQuery query;
-    query.exec(tr("select Parent, AskCount from Questions where ID = %1 and Parent <> -1")
-               .arg(questionID));
-    if(!query.next())   // questionID is the lead, nothing needs to be done
+    qint64 first = -1, last = -1;
+    {
+        Statement query(prepare("select coalesce(min(ID), 1), coalesce(max(ID), 0) from GroupChanges"));
+        if(exec(*query) && query->next())
+        {
+            first = query->value(0).toLongLong();
+            last  = query->value(1).toLongLong();
+        }
+    }
+    qint64 version = _questionGroups->getVersion();
+    if(last >= 0 && _questionGroups->isLoaded() && version == last)
+        return;
+
+    if(last >= 0 && _questionGroups->isLoaded() && version >= first - 1 && version < last &&
+       _questionGroups->update(getDatabase(), version))
+    {
+        _questionGroups->setVersion(last);
+        LOG_DEBUG("dao", tr("question groups updated, version %1").arg(last));
         return;
+    }
 
-    int leadID    = query.value(0).toInt();
-    int thisCount = query.value(1).toInt();   // this question's ask count
+    if(_questionGroups->load(getDatabase()))
+    {
+        _questionGroups->setVersion(last);
+        LOG_INFO("dao", tr("question groups loaded, version %1").arg(last));
+    }
+    else
+        LOG_ERROR("dao", tr("failed to load the question groups"));
+}
 
-    // ask count of the lead question
-    query.exec(tr("select AskCount from Questions where ID = %1").arg(leadID));
-    int leadCount = query.next() ? query.value(0).toInt() : 0;
+/**
+ * Write the Parent of the questions whose group or leader has changed, and log the changed
+ * questions in GroupChanges, one prepared statement per row
+ */
+void DAO::persistGroups()
+{
+    static const int changesKept = 10000;   // a writer further behind reloads all the groups
 
-    // cannot beat lead, no change
-    if(thisCount <= leadCount)
+    QuestionGroups::Changes changes = _questionGroups->takeChanges();
+    if(changes.questions.isEmpty())
         return;
 
-    // This question has higher ask count than the lead question
-    // all children of lead now become this question's chidren
-    query.exec(tr("update Questions set Parent = %1 where Parent = %2")
-               .arg(questionID).arg(leadID));
+    bool ok = true;
+    for(QHash<int, int>::const_iterator it = changes.parents.constBegin(); it != changes.parents.constEnd(); ++it)
+    {
+        Statement query(prepare("update Questions set Parent = :parent where ID = :id"));
+        query->bindValue(":parent", it.value());
+        query->bindValue(":id",     it.key());
+        ok = exec(*query) && ok;
+    }
 
-    // lead is now this question's child
-    query.exec(tr("update Questions set Parent = %1 where ID = %2")
-               .arg(questionID).arg(leadID));
+    qint64 lastChange = -1;
+    foreach(int questionID, changes.questions)
+    {
+        Statement query(prepare("insert into GroupChanges (QuestionID) values (:question)"));
+        query->bindValue(":question", questionID);
+        ok = exec(*query) && ok;
+        lastChange = query->lastInsertId().toLongLong();
+    }
+    Statement prune(prepare("delete from GroupChanges where ID <= :oldest"));
+    prune->bindValue(":oldest", lastChange - changesKept);
+    exec(*prune);
+    _questionGroups->setVersion(ok ? lastChange : -1);   // -1: reload next time
 
-    // Set this question to be nobody's child
-    query.exec(tr("update Questions set Parent = -1 where ID = %1")
-               .arg(questionID));
+    foreach(int leaderID, changes.deposed)
+        invalidateQuestion(leaderID);   // the old leader's APIs, and the new one's
 }
 
 /**
  * Update Answers table
  * @param link  - link to the answer page
  * @param title - title of the web page
+ * @return      - ID of the answer, -1 if link is empty
  */
-void DAO::updateAnswer(const QString& link, const QString& title)
+int DAO::updateAnswer(const QString& link, const QString& title)
 {
     if(link.isEmpty())
-        return;
+        return -1;
 
     // update existing answer or insert a new one
-    QSqlQuery query;
     int id = getAnswerID(link);
-    if(id > 0) {
-        query.prepare("update Answers set Link = :link, Title = :title where ID = :id");
-        query.bindValue(":id", id);
-    }
-    else {
-        query.prepare("insert into Answers values (:id, :link, :title)");
-        query.bindValue(":id", getNextID("Answers"));
+    if(id >= 0)
+    {
+        Statement query(prepare("update Answers set Title = :title where ID = :id and Title <> :old"));
+        query->bindValue(":id",    id);
+        query->bindValue(":title", title);
+        query->bindValue(":old",   title);
+        exec(*query);
+        if(query->numRowsAffected() > 0)
+            invalidateAnswer(id);
+        return id;
     }
-    query.bindValue(":link",  link);
-    query.bindValue(":title", title);
-    query.exec();
+
+    Statement query(prepare("insert into Answers values (:id, :link, :title)"));
+    query->bindValue(":link",  link);
+    query->bindValue(":title", title);
+    id = insertWithNewID("Answers", *query);
+    return id >= 0 ? id : getAnswerID(link);
 }
 
 void DAO::updateQuestionUserRelation(int groupID, int userID)
@@ -281,13 +726,15 @@ void DAO::updateQuestionUserRelation(int groupID, int userID)
     if(groupID < 0 || userID < 0)
         return;
 
-    QSqlQuery query;
-    query.exec(tr("delete from UserAskQuestion where GroupID = %1 and UserID = %2")
-               .arg(groupID)
-               .arg(userID));
-    query.exec(tr("insert into UserAskQuestion values (%1, %2)")
-               .arg(groupID)
-               .arg(userID));
+    Statement query(prepare("insert or ignore into UserAskQuestion values (:question, :other)"));
+    query->bindValue(":question", groupID);
+    query->bindValue(":other",    userID);
+    exec(*query);
+    if(query->numRowsAffected() > 0)
+    {
+        invalidateQuestion(groupID);
+        addUserQuestion(userID, groupID);
+    }
 }
 
 void DAO::updateQuestionAPIRelation(int groupID, int apiID)
@@ -295,13 +742,21 @@ void DAO::updateQuestionAPIRelation(int groupID, int apiID)
     if(groupID < 0 || apiID < 0)
         return;
 
-    QSqlQuery query;
-    query.exec(tr("delete from QuestionAboutAPI where GroupID = %1 and APIID = %2")
-               .arg(groupID)
-               .arg(apiID));
-    query.exec(tr("insert into QuestionAboutAPI values (%1, %2)")
-               .arg(groupID)
-               .arg(apiID));
+    Statement query(prepare("insert or ignore into QuestionAboutAPI values (:question, :other)"));
+    query->bindValue(":question", groupID);
+    query->bindValue(":other",    apiID);
+    exec(*query);
+    if(query->numRowsAffected() > 0)
+    {
+        invalidateQuestion(groupID);
+
+        // the API is in the profiles of the question's users
+        Statement profiles(prepare("insert or ignore into UserAPIs \
+                                    select UserID, :api from UserQuestions where QuestionID = :question"));
+        profiles->bindValue(":api",      apiID);
+        profiles->bindValue(":question", groupID);
+        exec(*profiles);
+    }
 }
 
 void DAO::updateQuestionAnswerRelation(int groupID, int answerID)
@@ -309,13 +764,12 @@ void DAO::updateQuestionAnswerRelation(int groupID, int answerID)
     if(groupID < 0 || answerID < 0)
         return;
 
-    QSqlQuery query;
-    query.exec(tr("delete from AnswerToQuestion where GroupID = %1 and AnswerID = %2")
-               .arg(groupID)
-               .arg(answerID));
-    query.exec(tr("insert into AnswerToQuestion values (%1, %2)")
-               .arg(groupID)
-               .arg(answerID));
+    Statement query(prepare("insert or ignore into AnswerToQuestion values (:question, :other)"));
+    query->bindValue(":question", groupID);
+    query->bindValue(":other",    answerID);
+    exec(*query);
+    if(query->numRowsAffected() > 0)
+        invalidateQuestion(groupID);
 }
 
 /**
@@ -330,22 +784,25 @@ void DAO::updateQuestionAnswerRelation(int groupID, int answerID)
 void DAO::save(const QString& userName, const QString& email, const QString& apiSig,
                const QString& question, const QString& link,  const QString& title)
 {
-    updateUser  (userName, email);
-    updateAPI   (apiSig);
-    updateAnswer(link, title);
+    int userID   = updateUser  (userName, email);
+    int apiID    = updateAPI   (apiSig);
+    int answerID = updateAnswer(link, title);
+    saveQuestion(question, userID, apiID, answerID);
+
+    LOG_DEBUG("dao", tr("save user=%1 api=%2 question=%3 link=%4").arg(userName).arg(apiSig).arg(question).arg(link));
+}
 
-    int apiID = getAPIID(apiSig);       // because we may have a new apiID
-    updateQuestion(question, apiID);
+/**
+ * Save a question and relate it to its user, API and answer, which exist already
+ */
+void DAO::saveQuestion(const QString& question, int userID, int apiID, int answerID)
+{
+    int questionID = updateQuestion(question, apiID);
 
     // update relationships
-    int answerID   = getAnswerID  (link);
-    int userID     = getUserID    (userName);
-    int questionID = getQuestionID(question);
     updateQuestionUserRelation  (questionID, userID);
     updateQuestionAPIRelation   (questionID, apiID);
     updateQuestionAnswerRelation(questionID, answerID);
-
-    qDebug() << "Save Q&A: " << userName << email << apiSig << question << link << title;
 }
 
 /**
@@ -356,11 +813,11 @@ void DAO::save(const QString& userName, const QString& email, const QString& api
  */
 void DAO::logDocumentReading(const QString& userName, const QString& email, const QString& apiSig)
 {
-    updateUser(userName, email);
-    updateAPI (apiSig);
-    addUserReadDocument(getUserID(userName), getAPIID(apiSig));
+    int userID = updateUser(userName, email);
+    int apiID  = updateAPI (apiSig);
+    addUserReadDocument(userID, apiID);
 
-    qDebug() << "Log document reading: " << userName << email << apiSig;
+    LOG_DEBUG("dao", tr("read user=%1 api=%2").arg(userName).arg(apiSig));
 }
 
 /**
@@ -371,49 +828,359 @@ void DAO::logDocumentReading(const QString& userName, const QString& email, cons
  */
 void DAO::logAnswerClicking(const QString& userName, const QString& email, const QString& link)
 {
-    updateUser(userName, email);
-    addUserClickAnswer(getUserID(userName), getAnswerID(link));
+    int userID = updateUser(userName, email);
+    addUserClickAnswer(userID, getAnswerID(link));
+
+    LOG_DEBUG("dao", tr("click user=%1 link=%2").arg(userName).arg(link));
+}
+
+/**
+ * Apply a write event queued by the server
+ */
+bool DAO::apply(const WriteEvent& event)
+{
+    static const int histogram = Metrics::getInstance()->getHistogram("faqs_stage_duration_seconds", "stage=\"save\"");
+    LatencyTimer timer(histogram);
 
-    qDebug() << "Log answer clicking: " << userName << email << link;
+    // all or nothing of the event's dozen statements, and one sync instead of one per statement
+    // without a transaction, e.g., the write lock is busy, the statements would autocommit one by one
+    Transaction transaction(this);
+    if(!transaction.isOpen())
+    {
+        LOG_ERROR("dao", tr("no transaction for event user=%1 type=%2").arg(event.userName).arg(event.type));
+        return false;
+    }
+    switch(event.type)
+    {
+    case WriteEvent::Save:
+        save(event.userName, event.email, event.apiSig, event.question, event.link, event.title);
+        break;
+    case WriteEvent::LogDocumentReading:
+        logDocumentReading(event.userName, event.email, event.apiSig);
+        break;
+    case WriteEvent::LogAnswerClicking:
+        logAnswerClicking(event.userName, event.email, event.link);
+        break;
+    }
+    if(transaction.commit())
+        return true;
+    LOG_ERROR("dao", tr("failed to apply event user=%1 type=%2").arg(event.userName).arg(event.type));
+    return false;
 }
 
 /**
- * Add a new record to UserReadDocument table
+ * @return  - why an event can't be applied, or an empty string if it can
  */
-void DAO::addUserReadDocument(int userID, int apiID)
+QString DAO::validate(const WriteEvent& event)
 {
-    QSqlQuery query;
-    query.prepare("insert into UserReadDocument values (:userID, :apiID, :time)");
-    query.bindValue(":userID", userID);
-    query.bindValue(":apiID",  apiID);
-    query.bindValue(":time",   getCurrentDateTime());
-    query.exec();
+    if(event.userName.isEmpty())
+        return "missing username";
+    if(event.type != WriteEvent::LogAnswerClicking && event.apiSig.isEmpty())
+        return "missing apisig";
+    if(event.type == WriteEvent::Save && event.question.isEmpty())
+        return "missing question";
+    if(event.type == WriteEvent::LogAnswerClicking && event.link.isEmpty())
+        return "missing link";
+    return QString();
 }
 
 /**
- * Add a new record to UserReadAnswer table
+ * Apply a batch of events in one transaction, each event in a savepoint of its own
+ * Users, APIs and answers are written and looked up once per batch, not once per event.
+ * An event with a failed statement is rolled back, and reported as not saved
+ * @param events    - the events
+ * @return          - status of each event, "ok" or the reason it was rejected
+ */
+QStringList DAO::applyBatch(const QList<WriteEvent>& events)
+{
+    QStringList results;
+    QHash<QString, int> userIDs;     // name      -> ID
+    QHash<QString, int> apiIDs;      // signature -> ID
+    QHash<QString, int> answerIDs;   // link      -> ID
+    QSet<QString>       savedAnswers;
+
+    // nothing is written outside of the transaction, the caller may send the batch again
+    if(!beginTransaction())
+    {
+        LOG_WARNING("dao", tr("no transaction for batch events=%1").arg(events.size()));
+        foreach(const WriteEvent& event, events)
+        {
+            QString error = validate(event);
+            results << "error: " + (error.isEmpty() ? QString("not saved") : error);
+        }
+        return results;
+    }
+
+    foreach(const WriteEvent& event, events)
+    {
+        QString error = validate(event);
+        if(!error.isEmpty())
+        {
+            results << "error: " + error;
+            continue;
+        }
+
+        Transaction transaction(this);   // a savepoint
+        int failed = failedStatements.localData();
+        if(!transaction.isOpen())
+        {
+            results << "error: not saved";
+            continue;
+        }
+
+        if(!userIDs.contains(event.userName))
+            userIDs.insert(event.userName, updateUser(event.userName, event.email));
+        int userID = userIDs.value(event.userName);
+
+        if(event.type != WriteEvent::LogAnswerClicking && !apiIDs.contains(event.apiSig))
+            apiIDs.insert(event.apiSig, updateAPI(event.apiSig));
+        int apiID = apiIDs.value(event.apiSig, -1);
+
+        if(event.type == WriteEvent::Save && !savedAnswers.contains(event.link))
+        {
+            answerIDs.insert(event.link, updateAnswer(event.link, event.title));   // may have been looked up before it existed
+            savedAnswers.insert(event.link);
+        }
+        if(event.type != WriteEvent::LogDocumentReading && !answerIDs.contains(event.link))
+            answerIDs.insert(event.link, getAnswerID(event.link));
+        int answerID = answerIDs.value(event.link, -1);
+
+        QString result = "ok";
+        switch(event.type)
+        {
+        case WriteEvent::Save:
+            saveQuestion(event.question, userID, apiID, answerID);
+            break;
+        case WriteEvent::LogDocumentReading:
+            addUserReadDocument(userID, apiID);
+            break;
+        case WriteEvent::LogAnswerClicking:
+            if(answerID < 0)
+                result = "error: unknown answer";
+            else
+                addUserClickAnswer(userID, answerID);
+            break;
+        }
+        if(result == "ok" && (failedStatements.localData() != failed || !transaction.commit()))
+            result = "error: not saved";
+
+        if(result != "ok")   // rolled back, with the rows the cached IDs may point to
+        {
+            userIDs  .clear();
+            apiIDs   .clear();
+            answerIDs.clear();
+            savedAnswers.clear();
+        }
+        results << result;
+    }
+
+    if(!commit())
+    {
+        rollback();
+        for(int i = 0; i < results.size(); ++i)
+            if(results[i] == "ok")
+                results[i] = "error: not saved";
+    }
+    else
+        for(int i = 0; i < results.size(); ++i)
+            if(results[i] == "ok")
+                stage(events[i]);
+
+    LOG_DEBUG("dao", tr("batch events=%1").arg(events.size()));
+    return results;
+}
+
+/**
+ * Log that a user read an API's document, only kept in the event log
+ */
+void DAO::addUserReadDocument(int userID, int apiID) {
+    addEvent(EventLog::ReadDocument, userID, apiID);
+}
+
+/**
+ * Log that a user clicked an answer, and make her a user of its question the first time
  */
 void DAO::addUserClickAnswer(int userID, int answerID)
 {
-    // find the question id associated with the answer
-    QSqlQuery query;
-    query.exec(tr("select QuestionID from AnswerToQuestion where AnswerID = %1")
-               .arg(answerID));
-    if(query.next())
+    // add a UserReadAnswer record for the question associated with the answer, the first one, as
+    // FAQGraph credits the lowest indexed question of an answer
+    int questionID;
+    bool related;   // the user is shown with the question already
     {
-        int questionID = query.value(0).toInt();
+        Statement query(prepare("select QuestionID, \
+                                   exists (select 1 from UserAskQuestion where UserID = :asker  and QuestionID = R.QuestionID \
+                                           union all \
+                                           select 1 from UserReadAnswer  where UserID = :reader and QuestionID = R.QuestionID) \
+                                 from AnswerToQuestion R where AnswerID = :answerID \
+                                 order by QuestionID limit 1"));
+        query->bindValue(":asker",    userID);
+        query->bindValue(":reader",   userID);
+        query->bindValue(":answerID", answerID);
+        exec(*query);
+        if(!query->next())
+            return;
+        questionID = query->value(0).toInt();
+        related    = query->value(1).toBool();
+    }
 
-        // add a UserReadAnswer record
-        query.prepare("insert into UserReadAnswer values (:userID, :questionID, :time)");
-        query.bindValue(":userID",     userID);
-        query.bindValue(":questionID", questionID);
-        query.bindValue(":time",       getCurrentDateTime());
-        query.exec();
+    // every click is history, only the first one makes the user a user of the question
+    addEvent(EventLog::ClickAnswer, userID, questionID);
+    if(related)
+        return;
+
+    Statement query(prepare("insert into UserReadAnswer values (:userID, :questionID, :time)"));
+    query->bindValue(":userID",     userID);
+    query->bindValue(":questionID", questionID);
+    query->bindValue(":time",       getCurrentTime());
+    exec(*query);
+    if(query->numRowsAffected() > 0)
+    {
+        invalidateQuestion(questionID);
+        addUserQuestion(userID, questionID);
     }
 }
 
-QString DAO::getCurrentDateTime() const {
-    return QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+/**
+ * Add a reading history event to the event log
+ * In a transaction, it's held until the transaction commits, and dropped if it rolls back
+ */
+void DAO::addEvent(int kind, int userID, int objectID)
+{
+    EventLog::Event event = {getCurrentTime(), kind, userID, objectID};
+    if(transactionDepth.localData() == 0)
+        EventLog::getInstance()->append(event);
+    else
+        getPendingEvents()->events << event;
+}
+
+/**
+ * A user has asked or viewed a question for the first time, add it to her profile aggregates:
+ * the question, its APIs, and one more shared question with each of its other users, both ways
+ */
+void DAO::addUserQuestion(int userID, int questionID)
+{
+    {
+        Statement query(prepare("insert or ignore into UserQuestions values (:user, :question)"));
+        query->bindValue(":user",     userID);
+        query->bindValue(":question", questionID);
+        exec(*query);
+        if(query->numRowsAffected() == 0)   // in the profile already
+            return;
+    }
+    {
+        Statement query(prepare("insert or ignore into UserAPIs \
+                                 select :user, APIID from QuestionAboutAPI where QuestionID = :question"));
+        query->bindValue(":user",     userID);
+        query->bindValue(":question", questionID);
+        exec(*query);
+    }
+
+    // the pairs that are new start from 0, then all the pairs of the question are counted up
+    {
+        Statement query(prepare("insert or ignore into UserRelated \
+                                 select :user, UserID, 0 from UserQuestions where QuestionID = :question and UserID != :self \
+                                 union all \
+                                 select UserID, :other, 0 from UserQuestions where QuestionID = :question2 and UserID != :self2"));
+        query->bindValue(":user",      userID);
+        query->bindValue(":question",  questionID);
+        query->bindValue(":self",      userID);
+        query->bindValue(":other",     userID);
+        query->bindValue(":question2", questionID);
+        query->bindValue(":self2",     userID);
+        exec(*query);
+    }
+    {
+        Statement query(prepare("update UserRelated set Shared = Shared + 1 \
+                                 where UserID = :user  and OtherID in (select UserID from UserQuestions where QuestionID = :question) \
+                                    or OtherID = :other and UserID  in (select UserID from UserQuestions where QuestionID = :question2)"));
+        query->bindValue(":user",      userID);
+        query->bindValue(":question",  questionID);
+        query->bindValue(":other",     userID);
+        query->bindValue(":question2", questionID);
+        exec(*query);
+    }
+}
+
+/**
+ * Log the APIs whose FAQs show a question: its own APIs, and those of its group's lead
+ * A question that was a lead a moment ago, or is one now, is covered either way
+ * Call it in the transaction of the change
+ */
+void DAO::invalidateQuestion(int questionID)
+{
+    if(questionID < 0)
+        return;
+
+    Statement query(prepare("insert into Invalidations (Signature) \
+                             select distinct Signature from Questions Q, QuestionAboutAPI R, APIs A \
+                             where Q.ID = :id and R.QuestionID in (Q.ID, Q.Parent) and A.ID = R.APIID"));
+    query->bindValue(":id", questionID);
+    exec(*query);
+
+    // keep the recent ones, a cache further behind than that starts over
+    QVariant last = query->lastInsertId();
+    if(last.isValid())
+    {
+        Statement prune(prepare("delete from Invalidations where ID <= :last - 10000"));
+        prune->bindValue(":last", last.toInt());
+        exec(*prune);
+    }
+}
+
+void DAO::invalidateUser(int userID)
+{
+    QList<int> questions;
+    {
+        Statement query(prepare("select QuestionID from UserAskQuestion where UserID = :asker \
+                                 union \
+                                 select QuestionID from UserReadAnswer  where UserID = :reader"));
+        query->bindValue(":asker",  userID);
+        query->bindValue(":reader", userID);
+        exec(*query);
+        while(query->next())
+            questions << query->value(0).toInt();
+    }
+    foreach(int questionID, questions)
+        invalidateQuestion(questionID);
+}
+
+void DAO::invalidateAnswer(int answerID)
+{
+    QList<int> questions;
+    {
+        Statement query(prepare("select QuestionID from AnswerToQuestion where AnswerID = :answer"));
+        query->bindValue(":answer", answerID);
+        exec(*query);
+        while(query->next())
+            questions << query->value(0).toInt();
+    }
+    foreach(int questionID, questions)
+        invalidateQuestion(questionID);
+}
+
+QMap<int, QString> DAO::getInvalidations(int afterID) const
+{
+    QMap<int, QString> result;
+    Statement query(prepare("select ID, Signature from Invalidations where ID > :after"));
+    query->bindValue(":after", afterID);
+    exec(*query);
+    while(query->next())
+        result.insert(query->value(0).toInt(), query->value(1).toString());
+    return result;
+}
+
+int DAO::getLastInvalidation() const
+{
+    Statement query(prepare("select max(ID) from Invalidations"));
+    exec(*query);
+    return query->next() ? query->value(0).toInt() : 0;
+}
+
+/**
+ * @return  - seconds since the epoch, the Time of the history tables
+ */
+qint64 DAO::getCurrentTime() const {
+    return QDateTime::currentMSecsSinceEpoch() / 1000;
 }
 
 // An example of returned JSON array:
@@ -447,154 +1214,204 @@ QString DAO::getCurrentDateTime() const {
  */
 QJsonDocument DAO::queryFAQs(const QString& classSig) const
 {
-    QJsonArray apisJson;
-    QSqlQuery query;
-    query.exec(tr("select ID, Signature from APIs where Signature like \'%1%\'").arg(classSig));    // FIXME: why fussy search?
+    if(_graph == 0)
+        return queryFAQsFromDatabase(classSig);
+
+    TRACE_SPAN("queryFAQs");
+    static const int histogram = Metrics::getInstance()->getHistogram("faqs_stage_duration_seconds", "stage=\"json\"");
+    LatencyTimer timer(histogram);
+    return QJsonDocument(_graph->queryFAQs(classSig));
+}
+
+QJsonDocument DAO::queryFAQsFromDatabase(const QString& classSig) const
+{
+    TRACE_SPAN("queryFAQs");
+    static const int histogram = Metrics::getInstance()->getHistogram("faqs_stage_duration_seconds", "stage=\"json\"");
+    LatencyTimer timer(histogram);
 
-    // for all the classes
-    while(query.next())
+    clearQueryTables();
+
+    // the class and its methods, i.e., the signatures starting with classSig
+    // positioned by rowid, the order of the scan of APIs the per-API queries did
+    if(_signatureIndex->isLoaded())
     {
-        int apiID = query.value(0).toInt();
-        QJsonArray questions = createQuestionsJson(apiID);  // questions about this API
-        if(!questions.isEmpty())
+        updateSignatureIndex(_signatureIndex->getWatermark());   // catch up with other processes and threads
+        QMap<int, QString> apis = _signatureIndex->find(classSig);
+        for(QMap<int, QString>::const_iterator it = apis.constBegin(); it != apis.constEnd(); ++it)
         {
-            QString apiSig = query.value(1).toString().section(";", -1, -1);  // remove library
-            QJsonObject apiJson;
-            apiJson.insert("apisig",    apiSig);
-            apiJson.insert("questions", questions);
-            apisJson.append(apiJson);
+            Statement query(prepare("insert into temp.QueryAPIs select ID, Signature, rowid from APIs where ID = :id"));
+            query->bindValue(":id", it.key());
+            exec(*query);
         }
     }
+    else   // cold start, LIKE scans the whole table
+    {
+        // LIKE's wildcards in classSig are escaped, they are literal chars of the signature
+        QString prefix = classSig;
+        prefix.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_");
+        Statement query(prepare("insert into temp.QueryAPIs \
+                                 select ID, Signature, rowid from APIs where Signature like :prefix escape '\\'"));
+        query->bindValue(":prefix", prefix + "%");
+        exec(*query);
+    }
+    QJsonArray apisJson = createAPIsJson(false);   // APIs without questions are left out
 
-    qDebug() << "Log query: " << apisJson;
+    LOG_PAYLOAD("dao", tr("query class=%1 result=%2").arg(classSig)
+                          .arg(QString(QJsonDocument(apisJson).toJson(QJsonDocument::Compact))));
 
     return QJsonDocument(apisJson);
 }
 
 /**
- * @return - a json object representing an answer
+ * Set based: a handful of joined statements for all the APIs, instead of a few per question.
+ * The APIs and their lead questions go to temp tables, private to this connection,
+ * which the users and answers statements join against
  */
-QJsonObject DAO::createAnswerJson(int answerID) const
+void DAO::clearQueryTables() const
 {
-    QJsonObject result;
-    QSqlQuery query;
-    query.exec(tr("select Link, Title from Answers where ID = %1").arg(answerID));
-    if(query.next())
-    {
-        result.insert("link",  query.value(0).toString());
-        result.insert("title", query.value(1).toString());
-    }
-    return result;
+    exec(*Statement(prepare("create temp table if not exists QueryAPIs  (ID int primary key, Signature varchar, Position int)")));
+    exec(*Statement(prepare("create temp table if not exists QueryLeads (ID int primary key)")));
+    exec(*Statement(prepare("delete from temp.QueryAPIs")));
+    exec(*Statement(prepare("delete from temp.QueryLeads")));
 }
 
 /**
- * @return - a json object representing a user
+ * @param withoutQuestions  - whether the APIs without questions are included
+ * @return                  - the APIs of temp.QueryAPIs, by Position, and their questions
+ * Lead questions and users are in ID order, answers by their first row in AnswerToQuestion's
+ * (QuestionID, AnswerID) primary key, the order of the per-question queries they replaced
  */
-QJsonObject DAO::createUserJson(int userID) const
+QJsonArray DAO::createAPIsJson(bool withoutQuestions) const
 {
-    QJsonObject result;
-    QSqlQuery query;
-    query.exec(tr("select Name, Email from Users where ID = %1").arg(userID));
-    if(query.next())
+    exec(*Statement(prepare("insert or ignore into temp.QueryLeads \
+                             select QuestionID from temp.QueryAPIs A, QuestionAboutAPI, Questions \
+                             where APIID = A.ID and QuestionID = Questions.ID and Parent = -1")));
+
+    // the questions of each group: the lead and its children
+    static const QString members =
+            "with Members (Lead, Member) as ( \
+                 select ID, ID from temp.QueryLeads \
+                 union all \
+                 select Parent, Questions.ID from Questions, temp.QueryLeads L where Parent = L.ID) ";
+
+    // users who asked or read any question of a group, by lead
+    QHash<int, QJsonArray> usersByLead;
     {
-        result.insert("name",  query.value(0).toString());
-        result.insert("email", query.value(1).toString());
+        Statement query(prepare(members +
+                                "select distinct Lead, Users.ID, Name, Email from Members, \
+                                   (select QuestionID, UserID from UserAskQuestion \
+                                    union \
+                                    select QuestionID, UserID from UserReadAnswer) R, Users \
+                                 where R.QuestionID = Member and Users.ID = R.UserID \
+                                 order by Lead, Users.ID"));
+        exec(*query);
+        while(query->next())
+        {
+            QJsonObject userJson;
+            userJson.insert("name",  query->value(2).toString());
+            userJson.insert("email", query->value(3).toString());
+            usersByLead[query->value(0).toInt()].append(userJson);
+        }
     }
-    return result;
-}
 
-/**
- * @param questionIDs   - IDs of the questions in a group
- * @return              - a json array representing the answers of a question group
- * NOTE: a group of questions are presented as one question to the user,
- * that's why we need to find all the questions and their answers in a group
- */
-QJsonArray DAO::createAnswersJson(const QStringList& questionIDs) const
-{
-    QJsonArray result;
-    QSqlQuery query;
-    query.exec(tr("select distinct AnswerID from AnswerToQuestion\
-                   where QuestionID in (%1)").arg(questionIDs.join(",")));
-    while(query.next())
+    // answers to any question of a group, by lead
+    // an answer to several questions of the group comes where the first of them puts it
+    QHash<int, QJsonArray> answersByLead;
     {
-        QJsonObject answerJson = createAnswerJson(query.value(0).toInt());
-        if(!answerJson.isEmpty())
-            result.append(answerJson);
+        Statement query(prepare(members +
+                                "select Lead, Answers.ID, Link, Title, min(Member) as First \
+                                 from Members, AnswerToQuestion, Answers \
+                                 where QuestionID = Member and Answers.ID = AnswerID \
+                                 group by Lead, Answers.ID \
+                                 order by Lead, First, Answers.ID"));
+        exec(*query);
+        while(query->next())
+        {
+            QJsonObject answerJson;
+            answerJson.insert("link",  query->value(2).toString());
+            answerJson.insert("title", query->value(3).toString());
+            answersByLead[query->value(0).toInt()].append(answerJson);
+        }
     }
-    return result;
-}
 
-/**
- * @param questionIDs   - IDs of the questions in a group
- * @return - a json array representing users how asked the questions in a group
- * NOTE: a group of questions are presented as one question to the user,
- * that's why we need to find all the questions and their answers in a group
- */
-QJsonArray DAO::createUsersJson(const QStringList& questionIDs) const
-{
-    QJsonArray result;
-    QSqlQuery query;
-    query.exec(tr("select distinct UserID from UserAskQuestion \
-                   where QuestionID in (%1) \
-                   union \
-                   select distinct UserID from UserReadAnswer \
-                   where QuestionID in (%1)").arg(questionIDs.join(",")));
-    while(query.next())
-        result.append(createUserJson(query.value(0).toInt()));
-    return result;
+    // one pass over the lead questions, grouped by API
+    // an API without any has a row of nulls
+    QJsonArray apisJson;
+    {
+        Statement query(prepare("select A.ID, Signature, Questions.ID, Question \
+                                 from temp.QueryAPIs A \
+                                      left join QuestionAboutAPI on APIID = A.ID \
+                                      left join Questions on QuestionID = Questions.ID and Parent = -1 \
+                                 order by A.Position, Questions.ID"));
+        exec(*query);
+        int        apiID = -1;
+        QString    apiSig;
+        QJsonArray questions;
+        for(bool more = query->next(); ; more = query->next())
+        {
+            if(!more || query->value(0).toInt() != apiID)   // an API is complete
+            {
+                if(apiID >= 0 && (withoutQuestions || !questions.isEmpty()))
+                {
+                    QJsonObject apiJson;
+                    apiJson.insert("apisig",    apiSig);
+                    apiJson.insert("questions", questions);
+                    apisJson.append(apiJson);
+                }
+                if(!more)
+                    break;
+                apiID     = query->value(0).toInt();
+                apiSig    = query->value(1).toString().section(";", -1, -1);  // remove library
+                questions = QJsonArray();
+            }
+
+            if(query->value(2).isNull())
+                continue;
+            int leadID = query->value(2).toInt();
+            QJsonObject questionJson;
+            questionJson.insert("question", query->value(3).toString());
+            questionJson.insert("users",    usersByLead  .value(leadID));
+            questionJson.insert("answers",  answersByLead.value(leadID));
+            questions.append(questionJson);
+        }
+    }
+
+    return apisJson;
 }
 
 /**
- * @param leadID    - ID of the lead question of a group
- * @return          - a json object representing a question and all related answers and users
+ * @return - a json object representing a user
  */
-QJsonObject DAO::createQuestionJson(int leadID) const
+QJsonObject DAO::createUserJson(int userID) const
 {
     QJsonObject result;
-    QSqlQuery query;
-    query.exec(tr("select Question from Questions where ID = %1").arg(leadID));
-    if(query.next())
+    Statement query(prepare("select Name, Email from Users where ID = :id"));
+    query->bindValue(":id", userID);
+    exec(*query);
+    if(query->next())
     {
-        result.insert("question", query.value(0).toString());  // lead question
-
-        // all questions in this group
-        QStringList questionIDs;
-        query.exec(tr("select ID from Questions \
-                       where Parent = %1 or ID = %1").arg(leadID));
-        while(query.next())
-            questionIDs << query.value(0).toString();
-
-        result.insert("users",   createUsersJson  (questionIDs));
-        result.insert("answers", createAnswersJson(questionIDs));
-        qDebug() << result;
+        result.insert("name",  query->value(0).toString());
+        result.insert("email", query->value(1).toString());
     }
-
     return result;
 }
 
 /**
- * @param apiID - ID of an API
- * @return      - a json array representing all the questions of the API
+ * @param userName  - user name
+ * @return          - a json document representing a user's profile, including her questions and answers
  */
-QJsonArray DAO::createQuestionsJson(int apiID) const
+QJsonDocument DAO::queryUserProfile(const QString& userName) const
 {
-    QJsonArray result;
+    if(_graph == 0)
+        return queryUserProfileFromDatabase(userName);
 
-    // find all lead questions
-    QSqlQuery query;
-    query.exec(tr("select QuestionID from QuestionAboutAPI, Questions\
-                   where QuestionID = ID and Parent = -1 and APIID = %1").arg(apiID));
-    while(query.next())
-        result.append(createQuestionJson(query.value(0).toInt()));  // question json
-    return result;
+    TRACE_SPAN("queryUserProfile");
+    return _graph->queryUserProfile(userName, Settings::getInstance()->getRelatedUsersLimit());
 }
 
-/**
- * @param userName  - user name
- * @return          - a json document representing a user's profile, including her questions and answers
- */
-QJsonDocument DAO::queryUserProfile(const QString& userName) const
+QJsonDocument DAO::queryUserProfileFromDatabase(const QString& userName) const
 {
+    TRACE_SPAN("queryUserProfile");
     int userID = getUserID(userName);
     if(userID == -1)
         return QJsonDocument();
@@ -602,61 +1419,126 @@ QJsonDocument DAO::queryUserProfile(const QString& userName) const
     // this person's profile
     QJsonObject profileJson;
     profileJson.insert("name", userName);
-    QSqlQuery query;
-    query.exec(tr("select Email from Users where ID = %1").arg(userID));
-    if(query.next())
-        profileJson.insert("email", query.value(0).toString());
-
-    // get all the questions userID relates to
-    // 1. get all the lead questions asked  by userID
-    // 2. get all the lead questions viewed by userID
-    // 3. merge (union) 1 and 2
-    query.exec(tr("select QuestionID from UserAskQuestion, Questions \
-                     where QuestionID = ID and Parent = -1 and UserID = %1 \
-                   union \
-                   select QuestionID from UserReadAnswer, Questions \
-                     where QuestionID = ID and Parent = -1 and UserID = %1 \
-                   order by QuestionID").arg(userID));
-    QStringList questions;
-    while(query.next())
-        questions << query.value(0).toString();
-
-    // get all the APIs associated with the questions
-    query.exec(tr("select distinct ID, Signature from APIs, QuestionAboutAPI \
-                  where ID = APIID and QuestionID in (%1)").arg(questions.join(",")));
-
-    QJsonArray apisJson;
-    while(query.next())
     {
-        int     apiID  = query.value(0).toInt();
-        QString apiSig = query.value(1).toString().section(";", -1, -1);  // remove library
-        QJsonObject apiJson;                                          // json for this api
-        apiJson.insert("apisig",    apiSig);                          // save api to json
-        apiJson.insert("questions", createQuestionsJson(apiID));      // save questions to json
-        apisJson.append(apiJson);                                     // add this json to api json array
+        Statement query(prepare("select Email from Users where ID = :id"));
+        query->bindValue(":id", userID);
+        exec(*query);
+        if(query->next())
+            profileJson.insert("email", query->value(0).toString());
     }
-    profileJson.insert("apis", apisJson);   // add apis
 
-    // get all other users associated with the questions
-    query.exec(tr("select Name, Email from UserAskQuestion, Users \
-                     where QuestionID in (%1) and UserID = ID and UserID != %2 \
-                   union \
-                   select Name, Email from UserReadAnswer, Users \
-                     where QuestionID in (%1) and UserID = ID and UserID != %2")
-               .arg(questions.join(",")).arg(userID));
-
-    QJsonArray usersJson;
-    while(query.next())
+    // the APIs of the questions the user asked or viewed, from the profile aggregates, by ID,
+    // with their questions assembled as queryFAQs does
+    clearQueryTables();
     {
-        QString name  = query.value(0).toString();
-        QString email = query.value(1).toString();
-        QJsonObject userJson;             // json for this user
-        userJson.insert("name",  name);
-        userJson.insert("email", email);
-        usersJson.append(userJson);       // add this json to users json array
+        Statement query(prepare("insert into temp.QueryAPIs \
+                                 select ID, Signature, ID from UserAPIs, APIs where UserID = :user and ID = APIID"));
+        query->bindValue(":user", userID);
+        exec(*query);
     }
+    profileJson.insert("apis", createAPIsJson(true));   // add apis
+
+    // the other users of those questions, those sharing the most first
+    QJsonArray usersJson;
+    updateRelatedUsers();
+    foreach(const RelatedUsersGraph::Edge& edge,
+            _relatedUsers->getTopRelated(userID, Settings::getInstance()->getRelatedUsersLimit()))
+        usersJson.append(createUserJson(edge.first));
     profileJson.insert("relatedusers", usersJson);   // add related users
 
-    qDebug() << "Query user profile: " << userName;
+    LOG_DEBUG("dao", tr("profile user=%1").arg(userName));
     return QJsonDocument(profileJson);
 }
+
+void DAO::stage(const WriteEvent& event)
+{
+    if(_graph != 0)
+        _graph->apply(event);
+}
+
+/**
+ * The order of an array's elements doesn't matter to the comparison, the indexes of the graph
+ * and the IDs of the database may order them differently
+ */
+static QJsonValue canonical(const QJsonValue& value)
+{
+    if(value.isObject())
+    {
+        QJsonObject object = value.toObject();
+        for(QJsonObject::iterator it = object.begin(); it != object.end(); ++it)
+            it.value() = canonical(it.value());
+        return object;
+    }
+    if(value.isArray())
+    {
+        QMap<QByteArray, QJsonValue> sorted;   // compact json -> element
+        foreach(const QJsonValue& element, value.toArray())
+        {
+            QJsonValue canonicalElement = canonical(element);
+            QJsonArray wrapper;
+            wrapper.append(canonicalElement);
+            sorted.insertMulti(QJsonDocument(wrapper).toJson(QJsonDocument::Compact), canonicalElement);
+        }
+        QJsonArray array;
+        foreach(const QJsonValue& element, sorted)
+            array.append(element);
+        return array;
+    }
+    return value;
+}
+
+/**
+ * Compare the graph's answers with the database's, for random classes and users
+ * A write still queued for the database shows up as a mismatch, one found again by the
+ * next check is real
+ */
+int DAO::checkGraph(int sampleSize) const
+{
+    static const int mismatches = Metrics::getInstance()->getCounter("faqs_graph_mismatches_total");
+    if(_graph == 0)
+        return 0;
+
+    int result = 0;
+    {
+        Statement query(prepare("select Signature from APIs order by random() limit :size"));
+        query->bindValue(":size", sampleSize);
+        exec(*query);
+        QStringList classes;
+        while(query->next())
+        {
+            QString signature = query->value(0).toString();
+            classes << signature.left(signature.lastIndexOf('.'));   // the whole signature if there's no method
+        }
+        query->finish();
+
+        foreach(const QString& classSig, classes)
+            if(canonical(QJsonDocument(_graph->queryFAQs(classSig)).array()) !=
+               canonical(queryFAQsFromDatabase(classSig).array()))
+            {
+                LOG_WARNING("dao", tr("graph mismatch class=%1").arg(classSig));
+                ++ result;
+            }
+    }
+    {
+        Statement query(prepare("select Name from Users order by random() limit :size"));
+        query->bindValue(":size", sampleSize);
+        exec(*query);
+        QStringList users;
+        while(query->next())
+            users << query->value(0).toString();
+        query->finish();
+
+        int limit = Settings::getInstance()->getRelatedUsersLimit();
+        foreach(const QString& userName, users)
+            if(canonical(_graph->queryUserProfile(userName, limit).object()) !=
+               canonical(queryUserProfileFromDatabase(userName).object()))
+            {
+                LOG_WARNING("dao", tr("graph mismatch user=%1").arg(userName));
+                ++ result;
+            }
+    }
+
+    Metrics::getInstance()->add(mismatches, result);
+    LOG_INFO("dao", tr("graph checked sample=%1 mismatches=%2").arg(sampleSize).arg(result));
+    return result;
+}
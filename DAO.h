@@ -2,9 +2,21 @@
 #define DAO_H
 
 #include <QObject>
+#include <QStringList>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
 
 class QJsonDocument;
+class QSqlDatabase;
+class QSqlQuery;
 class SimilarityComparer;
+class IDAllocator;
+class SignatureIndex;
+class RelatedUsersGraph;
+class FAQGraph;
+class QuestionGroups;
+struct WriteEvent;
 
 // 读写数据库的DAO
 class DAO : public QObject
@@ -24,19 +36,63 @@ public:
     // log answer clicking history
     void logAnswerClicking(const QString& userName, const QString& email, const QString& link);
 
+    // apply a write event, i.e., one of the above, false if it is not saved
+    bool apply(const WriteEvent& event);
+
+    // apply a batch of write events in one transaction, returns the status of each
+    QStringList applyBatch(const QList<WriteEvent>& events);
+    static QString validate(const WriteEvent& event);   // why the event can't be applied, empty if it can
+
+    // apply an accepted write event to the in-memory graph, ahead of apply()
+    void stage(const WriteEvent& event);
+
+    // compare the in-memory graph with the database on a sample of classes and users
+    // returns the # of mismatches
+    int checkGraph(int sampleSize) const;
+
+    // transaction on the current thread's connection
+    bool beginTransaction();
+    bool commit();
+    bool rollback();
+
+    // close the current thread's connection, call before the thread ends
+    void closeDatabase();
+
     // query FAQs for an API (class)
     QJsonDocument queryFAQs(const QString& classSig) const;
 
     // query personal profile
     QJsonDocument queryUserProfile(const QString& userName) const;
 
+    // API signatures whose FAQs have changed since invalidation afterID, ID -> signature
+    QMap<int, QString> getInvalidations(int afterID) const;
+    int getLastInvalidation() const;   // 0 if none
+
+public slots:
+    void saveSnapshots();   // of the in-memory indexes, for a fast restart
+    void compactHistory();  // roll up the old events of the event log
+    void flushHistory();    // write the buffered events, for when no more events come to flush them
+
 private slots:
     void onComparisonResult(const QString& leadQuestion,
                             const QString& question, qreal similarity);
 
 private:
     DAO();
-    int getNextID    (const QString& tableName) const;
+    QString      getConnectionName() const;
+    QSqlDatabase getDatabase()       const;   // connection of the current thread
+    QSqlQuery* prepare(const QString& sql) const;   // cached for the current thread's connection
+    bool exec(QSqlQuery& query) const;              // timed
+
+    QJsonDocument queryFAQsFromDatabase       (const QString& classSig) const;
+    QJsonDocument queryUserProfileFromDatabase(const QString& userName) const;
+
+    void updateSignatureIndex(qint64 afterRowID) const;   // index the APIs with rowid > afterRowID
+    void loadRelatedUsers();                        // from the snapshot, or the UserRelated table
+    void updateRelatedUsers() const;                // replay the new UserQuestions rows
+
+    int insertWithNewID(const QString& tableName, QSqlQuery& query);   // query has an :id placeholder
+    void seedID        (const QString& tableName);
     int getID(const QString& tableName, const QString& section, const QString& value) const;
 
     int getUserID    (const QString& userName)  const;   // for convenience
@@ -44,36 +100,51 @@ private:
     int getQuestionID(const QString& question)  const;
     int getAnswerID  (const QString& link)      const;
 
-    void updateUser    (const QString& userName, const QString& email);  // update single table
-    void updateAPI     (const QString& signature);
-    void updateQuestion(const QString& question, int apiID);
-    void updateAnswer  (const QString& link, const QString& title);
+    int updateUser    (const QString& userName, const QString& email);  // update single table, return the row's ID
+    int updateAPI     (const QString& signature);
+    int updateQuestion(const QString& question, int apiID);
+    int updateAnswer  (const QString& link, const QString& title);
 
     void updateQuestionUserRelation  (int groupID, int userID);           // update relation table
     void updateQuestionAPIRelation   (int groupID, int apiID);
     void updateQuestionAnswerRelation(int groupID, int answerID);
 
-    void updateLead(int questionID);   // try to make questionID the new lead
+    void syncGroups();      // catch the question groups up with the changes of other processes
+    void persistGroups();   // write the rows the question groups changed
+
+    // log the APIs whose FAQs show the question, its group, the user's or the answer's questions
+    void invalidateQuestion(int questionID);
+    void invalidateUser    (int userID);
+    void invalidateAnswer  (int answerID);
+
+    // save a question about an API, asked by a user, answered by an answer
+    void saveQuestion(const QString& question, int userID, int apiID, int answerID);
 
     // initiate comparison between the question and other lead questions associated with apiID
     void measureSimilarity(const QString& question, int apiID);
 
     void addUserReadDocument(int userID, int apiID);     // user viewed API doc
     void addUserClickAnswer (int userID, int answerID);  // user clicked the answer
+    void addUserQuestion    (int userID, int questionID);   // update the profile aggregates
+    void addEvent(int kind, int userID, int objectID);       // to the event log, once committed
 
     // table -> json
-    QJsonObject createAnswerJson    (int answerID) const;  // an answer -> json
-    QJsonObject createUserJson      (int userID)   const;  // a user    -> json
-    QJsonArray  createAnswersJson   (const QStringList& questionIDs) const;  // question group -> its answers
-    QJsonArray  createUsersJson     (const QStringList& questionIDs) const;  // question group -> its users
-    QJsonObject createQuestionJson (int leadID) const;  // question group -> json
-    QJsonArray  createQuestionsJson(int apiID)  const;  // api            -> its questions
+    QJsonObject createUserJson(int userID) const;            // a user -> json
+    void        clearQueryTables() const;                    // temp.QueryAPIs and temp.QueryLeads
+    QJsonArray  createAPIsJson(bool withoutQuestions) const; // temp.QueryAPIs -> the APIs and their questions
 
-    QString getCurrentDateTime() const;
+    qint64 getCurrentTime() const;
 
 private:
-    static DAO* _instance;
     SimilarityComparer* _comparer;
+    QHash<QString, IDAllocator*> _idAllocators;   // table name -> its IDs, fixed after construction
+    SignatureIndex*              _signatureIndex;
+    RelatedUsersGraph*           _relatedUsers;
+    mutable QMutex               _relatedUsersMutex;   // one replay at a time, and no snapshot during it
+    FAQGraph*                    _graph;               // answers the queries, 0 if the database does
+    QuestionGroups*              _questionGroups;      // loaded by the first write
+
+    friend class SignatureLoader;
 };
 
 #endif // DAO_H
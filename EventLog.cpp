@@ -0,0 +1,460 @@
+﻿#include "EventLog.h"
+#include "Settings.h"
+#include "Logger.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDir>
+#include <QDateTime>
+#include <QCoreApplication>
+#include <QHash>
+#include <QtEndian>
+#include <algorithm>
+
+static const quint32 BlockMagic  = 0x31425645;   // "EVB1"
+static const quint32 RollupMagic = 0x31525645;   // "EVR1"
+static const int     HeaderSize  = 12;           // magic, payload size, # of rows
+static const qint64  SecondsPerDay = 24 * 60 * 60;
+
+//////////////////////////////////////////////////////////////////////////
+// column encoding
+
+static void writeVarint(QByteArray& out, quint64 value)
+{
+    while(value >= 0x80)
+    {
+        out.append(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+// false if the column is cut short
+static bool readVarint(const char*& p, const char* end, quint64& value)
+{
+    value = 0;
+    for(int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        quint8 byte = static_cast<quint8>(*p++);
+        value |= quint64(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static quint64 zigzag  (qint64  value) { return (quint64(value) << 1) ^ quint64(value >> 63); }
+static qint64  unzigzag(quint64 value) { return qint64(value >> 1) ^ -qint64(value & 1); }
+
+// IDs as the sorted dictionary of the distinct ones, then each as its index in it
+static void writeIDs(QByteArray& out, const QVector<int>& ids)
+{
+    QVector<int> dictionary = ids;
+    std::sort(dictionary.begin(), dictionary.end());
+    dictionary.erase(std::unique(dictionary.begin(), dictionary.end()), dictionary.end());
+
+    writeVarint(out, dictionary.size());
+    foreach(int id, dictionary)
+        writeVarint(out, zigzag(id));
+    foreach(int id, ids)
+        writeVarint(out, std::lower_bound(dictionary.begin(), dictionary.end(), id) - dictionary.begin());
+}
+
+static bool readIDs(const char*& p, const char* end, int count, QVector<int>& ids)
+{
+    quint64 size, value;
+    if(!readVarint(p, end, size) || size > quint64(end - p))
+        return false;
+    QVector<int> dictionary(static_cast<int>(size));
+    for(int i = 0; i < dictionary.size(); ++i)
+    {
+        if(!readVarint(p, end, value))
+            return false;
+        dictionary[i] = static_cast<int>(unzigzag(value));
+    }
+    ids.resize(count);
+    for(int i = 0; i < count; ++i)
+    {
+        if(!readVarint(p, end, value) || value >= size)
+            return false;
+        ids[i] = dictionary[static_cast<int>(value)];
+    }
+    return true;
+}
+
+static QByteArray createHeader(quint32 magic, int payloadSize, int count)
+{
+    QByteArray header(HeaderSize, 0);
+    qToLittleEndian<quint32>(magic,       reinterpret_cast<uchar*>(header.data()));
+    qToLittleEndian<quint32>(payloadSize, reinterpret_cast<uchar*>(header.data()) + 4);
+    qToLittleEndian<quint32>(count,       reinterpret_cast<uchar*>(header.data()) + 8);
+    return header;
+}
+
+// false at the end of the data, or at a block cut short by a crash
+static bool readHeader(const char*& p, const char* end, quint32 magic, int& payloadSize, int& count)
+{
+    if(end - p < HeaderSize || qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(p)) != magic)
+        return false;
+    payloadSize = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(p) + 4);
+    count       = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(p) + 8);
+    p += HeaderSize;
+    return payloadSize >= 0 && payloadSize <= end - p && count >= 0 && count <= payloadSize;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+EventLog* EventLog::getInstance()
+{
+    static EventLog* instance = new EventLog;
+    return instance;
+}
+
+EventLog::EventLog()
+{
+    Settings* settings = Settings::getInstance();
+    _blockSize     = settings->getEventBlockSize();
+    _flushInterval = settings->getEventFlushInterval();
+    _retention     = settings->getEventRetentionDays();
+    _sinceFlush.start();
+    QDir().mkpath("Events");
+}
+
+QString EventLog::getDay(qint64 time) const {
+    return QDateTime::fromMSecsSinceEpoch(time * 1000, Qt::UTC).toString("yyyy-MM-dd");
+}
+
+void EventLog::append(const Event& event)
+{
+    QMutexLocker locker(&_mutex);
+    if(!_buffer.isEmpty() && getDay(event.time) != getDay(_buffer.first().time))   // a block is of one day
+        flushLocked();
+
+    _buffer << event;
+    if(_buffer.size() >= _blockSize || _sinceFlush.elapsed() >= _flushInterval)
+        flushLocked();
+}
+
+void EventLog::flush()
+{
+    QMutexLocker locker(&_mutex);
+    flushLocked();
+}
+
+/**
+ * Append the buffer, as one block, to the segment of its day
+ */
+void EventLog::flushLocked()
+{
+    _sinceFlush.restart();
+    if(_buffer.isEmpty())
+        return;
+
+    QString filePath = QString("Events/%1-%2.seg").arg(getDay(_buffer.first().time))
+                                                  .arg(QCoreApplication::applicationPid());
+    if(!appendBlock(filePath, _buffer))
+        LOG_ERROR("events", QString("failed to write %1 events=%2").arg(filePath).arg(_buffer.size()));
+    _buffer.clear();
+}
+
+/**
+ * Append events as one block: kinds, delta encoded times, users and objects
+ */
+bool EventLog::appendBlock(const QString& filePath, const QVector<Event>& events) const
+{
+    QByteArray   payload;
+    QVector<int> users, objects;
+    for(int i = 0; i < events.size(); ++i)
+        payload.append(static_cast<char>(events[i].kind));
+    qint64 previous = 0;
+    for(int i = 0; i < events.size(); ++i)
+    {
+        writeVarint(payload, zigzag(events[i].time - previous));
+        previous = events[i].time;
+        users   << events[i].userID;
+        objects << events[i].objectID;
+    }
+    writeIDs(payload, users);
+    writeIDs(payload, objects);
+
+    QFile file(filePath);
+    if(!file.open(QFile::WriteOnly | QFile::Append))
+        return false;
+    QByteArray block = createHeader(BlockMagic, payload.size(), events.size()) + payload;
+    return file.write(block) == block.size();
+}
+
+/**
+ * Staged events go to Events/Staged-<tag>/<day>.seg, out of the sight of scan() and compact()
+ */
+bool EventLog::stage(const QString& tag, const QVector<Event>& events)
+{
+    discardStaged(tag);
+    QString dirPath = "Events/Staged-" + tag;
+    if(!QDir().mkpath(dirPath))
+        return false;
+
+    // blocks of a day each
+    QHash<QString, QVector<Event> > eventsByDay;
+    foreach(const Event& event, events)
+        eventsByDay[getDay(event.time)] << event;
+    for(QHash<QString, QVector<Event> >::const_iterator it = eventsByDay.constBegin(); it != eventsByDay.constEnd(); ++it)
+        for(int i = 0; i < it.value().size(); i += _blockSize)
+            if(!appendBlock(QString("%1/%2.seg").arg(dirPath).arg(it.key()), it.value().mid(i, _blockSize)))
+                return false;
+    return true;
+}
+
+/**
+ * Each staged day becomes a segment, Events/<day>-staged-<tag>.seg
+ * A rename is atomic, so two processes publishing at once publish each day once
+ */
+void EventLog::publishStaged(const QString& tag)
+{
+    QDir dir("Events/Staged-" + tag);
+    if(!dir.exists())
+        return;
+    foreach(const QString& fileName, dir.entryList(QStringList("*.seg"), QDir::Files, QDir::Name))
+        QFile::rename(dir.filePath(fileName), QString("Events/%1-staged-%2.seg").arg(fileName.left(10)).arg(tag));
+    QDir("Events").rmdir("Staged-" + tag);
+    LOG_INFO("events", QString("published staged events tag=%1").arg(tag));
+}
+
+void EventLog::discardStaged(const QString& tag) {
+    QDir("Events/Staged-" + tag).removeRecursively();
+}
+
+QStringList EventLog::getStagedTags() const
+{
+    QStringList result;
+    foreach(const QString& dirName, QDir("Events").entryList(QStringList("Staged-*"), QDir::Dirs))
+        result << dirName.mid(7);   // after "Staged-"
+    return result;
+}
+
+QVector<EventLog::Event> EventLog::readSegment(const QString& filePath) const
+{
+    QVector<Event> result;
+    QFile file(filePath);
+    if(!file.open(QFile::ReadOnly))
+        return result;
+
+    QByteArray data = file.readAll();
+    const char* p   = data.constData();
+    const char* end = p + data.size();
+    int payloadSize, count;
+    while(readHeader(p, end, BlockMagic, payloadSize, count))
+    {
+        const char* blockEnd = p + payloadSize;
+        const char* kinds    = p;
+        p += count;
+
+        QVector<qint64> times(count);
+        qint64  previous = 0;
+        quint64 value;
+        bool    ok = true;
+        for(int i = 0; i < count && ok; ++i)
+        {
+            ok = readVarint(p, blockEnd, value);
+            times[i] = previous += unzigzag(value);
+        }
+        QVector<int> users, objects;
+        if(!ok || !readIDs(p, blockEnd, count, users) || !readIDs(p, blockEnd, count, objects))
+        {
+            LOG_WARNING("events", QString("corrupt block in %1").arg(filePath));
+            break;
+        }
+
+        for(int i = 0; i < count; ++i)
+        {
+            Event event = {times[i], kinds[i], users[i], objects[i]};
+            result << event;
+        }
+        p = blockEnd;
+    }
+    return result;
+}
+
+QVector<EventLog::Event> EventLog::scan(qint64 from, qint64 to) const
+{
+    QVector<Event> result;
+    QDir dir("Events");
+    QHash<QString, Manifest> manifests;   // day -> segments its rollup covers
+    foreach(const QString& fileName, dir.entryList(QStringList("*.seg"), QDir::Files, QDir::Name))
+    {
+        // segments are named by day, skip those out of the range
+        QString day = fileName.left(10);
+        if(day < getDay(from) || day > getDay(to - 1))
+            continue;
+
+        // left behind by a compaction that crashed, counted by the rollup
+        if(!manifests.contains(day))
+            readRollup(dir.filePath(day + ".rollup"), &manifests[day]);
+        if(manifests[day].value(fileName, -1) == QFileInfo(dir, fileName).size())
+            continue;
+        foreach(const Event& event, readSegment(dir.filePath(fileName)))
+            if(event.time >= from && event.time < to)
+                result << event;
+    }
+    return result;
+}
+
+QHash<int, int> EventLog::countByObject(int kind, qint64 from, qint64 to) const
+{
+    QHash<int, int> result;
+    foreach(const Event& event, scan(from, to))
+        if(event.kind == kind)
+            ++ result[event.objectID];
+
+    QDir dir("Events");
+    foreach(const QString& fileName, dir.entryList(QStringList("*.rollup"), QDir::Files, QDir::Name))
+    {
+        QString day = fileName.left(10);
+        if(day < getDay(from) || day > getDay(to - 1))
+            continue;
+        QHash<RollupKey, int> counts = readRollup(dir.filePath(fileName));
+        for(QHash<RollupKey, int>::const_iterator it = counts.constBegin(); it != counts.constEnd(); ++it)
+            if(it.key().first == kind)
+                result[it.key().second.second] += it.value();
+    }
+    return result;
+}
+
+/**
+ * Roll the segments of the days older than the retention up, into one file per day
+ * A day rolled up before, e.g., by another process, has its rollup merged with the new segments
+ * The rollup lists the segments it covers, so that those a crash left behind once it was written
+ * are deleted rather than counted again
+ */
+void EventLog::compact()
+{
+    flush();
+
+    QString oldestKept = getDay(QDateTime::currentMSecsSinceEpoch() / 1000 - qint64(_retention) * SecondsPerDay);
+    QDir dir("Events");
+    QHash<QString, QStringList> segmentsByDay;
+    foreach(const QString& fileName, dir.entryList(QStringList("*.seg"), QDir::Files, QDir::Name))
+        if(fileName.left(10) < oldestKept)
+            segmentsByDay[fileName.left(10)] << dir.filePath(fileName);
+
+    for(QHash<QString, QStringList>::const_iterator it = segmentsByDay.constBegin(); it != segmentsByDay.constEnd(); ++it)
+    {
+        QString  rollupPath = dir.filePath(it.key() + ".rollup");
+        Manifest manifest;
+        QHash<RollupKey, int> counts = readRollup(rollupPath, &manifest);
+        QStringList rolledUp;
+        int events = 0;
+        foreach(const QString& segment, it.value())
+        {
+            QFileInfo info(segment);
+            if(manifest.value(info.fileName(), -1) == info.size())
+            {
+                LOG_WARNING("events", QString("removing %1, already rolled up").arg(segment));
+                QFile::remove(segment);
+                continue;
+            }
+            foreach(const Event& event, readSegment(segment))
+            {
+                ++ counts[qMakePair(event.kind, qMakePair(event.userID, event.objectID))];
+                ++ events;
+            }
+            manifest.insert(info.fileName(), info.size());
+            rolledUp << segment;
+        }
+        if(rolledUp.isEmpty())
+            continue;
+
+        if(!writeRollup(rollupPath, counts, manifest))
+        {
+            LOG_ERROR("events", QString("failed to write %1").arg(rollupPath));
+            continue;
+        }
+        foreach(const QString& segment, rolledUp)
+            QFile::remove(segment);
+        LOG_INFO("events", QString("rolled up day=%1 events=%2 rows=%3").arg(it.key()).arg(events).arg(counts.size()));
+    }
+}
+
+QHash<EventLog::RollupKey, int> EventLog::readRollup(const QString& filePath, Manifest* manifest) const
+{
+    QHash<RollupKey, int> result;
+    QFile file(filePath);
+    if(!file.open(QFile::ReadOnly))
+        return result;
+
+    QByteArray data = file.readAll();
+    const char* p   = data.constData();
+    const char* end = p + data.size();
+    int payloadSize, count;
+    if(!readHeader(p, end, RollupMagic, payloadSize, count))
+        return result;
+
+    const char*  kinds = p;
+    p += count;
+    QVector<int> users, objects;
+    if(!readIDs(p, end, count, users) || !readIDs(p, end, count, objects))
+        return result;
+    quint64 value;
+    for(int i = 0; i < count; ++i)
+    {
+        if(!readVarint(p, end, value))
+            return result;
+        result.insert(qMakePair(int(kinds[i]), qMakePair(users[i], objects[i])), static_cast<int>(value));
+    }
+
+    // the manifest: # of segments, then each one's name and size
+    if(manifest == 0 || !readVarint(p, end, value))
+        return result;
+    for(quint64 segments = value; segments > 0; --segments)
+    {
+        quint64 length, size;
+        if(!readVarint(p, end, length) || length > quint64(end - p))
+            break;
+        QString name = QString::fromUtf8(p, static_cast<int>(length));
+        p += length;
+        if(!readVarint(p, end, size))
+            break;
+        manifest->insert(name, static_cast<qint64>(size));
+    }
+    return result;
+}
+
+/**
+ * A rollup is a single block: kinds, users, objects and counts, then the manifest of the
+ * segments rolled up into it
+ */
+bool EventLog::writeRollup(const QString& filePath, const QHash<RollupKey, int>& counts,
+                           const Manifest& manifest) const
+{
+    QList<RollupKey> keys = counts.keys();
+    std::sort(keys.begin(), keys.end());
+
+    QByteArray   payload;
+    QVector<int> users, objects;
+    foreach(const RollupKey& key, keys)
+    {
+        payload.append(static_cast<char>(key.first));
+        users   << key.second.first;
+        objects << key.second.second;
+    }
+    writeIDs(payload, users);
+    writeIDs(payload, objects);
+    foreach(const RollupKey& key, keys)
+        writeVarint(payload, counts.value(key));
+
+    writeVarint(payload, manifest.size());
+    for(Manifest::const_iterator it = manifest.constBegin(); it != manifest.constEnd(); ++it)
+    {
+        QByteArray name = it.key().toUtf8();
+        writeVarint(payload, name.size());
+        payload.append(name);
+        writeVarint(payload, it.value());
+    }
+
+    QSaveFile file(filePath);
+    if(!file.open(QFile::WriteOnly))
+        return false;
+    file.write(createHeader(RollupMagic, payload.size(), keys.size()) + payload);
+    return file.commit();
+}
@@ -0,0 +1,80 @@
+﻿#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QPair>
+#include <QMutex>
+#include <QElapsedTimer>
+
+// Append-only store of the reading history (API docs read, answers clicked), kept out of the
+// database that answers the queries
+// Events are partitioned by UTC day into segment files, Events/<day>-<pid>.seg, one per process,
+// so that processes never append to the same file. A segment is a sequence of blocks, each
+// holding a few thousand events column by column: kinds, delta encoded times, and user and
+// object IDs encoded against the block's dictionary of distinct IDs, all as varints.
+// Days older than the retention are compacted into Events/<day>.rollup, the # of events per
+// kind, user and object, and their segments are deleted. A rollup names the segments it
+// covers, so that a segment a crash kept after its rollup was written is never counted twice.
+// Events can also be staged aside, in Events/Staged-<tag>/, e.g., by a migration, and published
+// as segments only once the change they belong to has committed.
+// Thread safe
+class EventLog
+{
+public:
+    enum Kind {ReadDocument, ClickAnswer};   // the object is an API, or a question
+
+    struct Event
+    {
+        qint64 time;       // seconds since the epoch
+        int    kind;
+        int    userID;
+        int    objectID;
+    };
+
+public:
+    static EventLog* getInstance();
+
+    void append(const Event& event);   // buffered, written a block at a time
+    void flush();                      // write the buffered events
+
+    // stage events under a tag, replacing what was staged under it before
+    bool stage(const QString& tag, const QVector<Event>& events);
+    void publishStaged(const QString& tag);   // the staged events become part of the log
+    void discardStaged(const QString& tag);
+    QStringList getStagedTags() const;
+
+    // the events of [from, to) that have not been compacted yet
+    QVector<Event> scan(qint64 from, qint64 to) const;
+
+    // object ID -> # of events of a kind in [from, to), compacted days counted as a whole
+    QHash<int, int> countByObject(int kind, qint64 from, qint64 to) const;
+
+    void compact();   // roll up the days older than the retention
+
+private:
+    EventLog();
+    void flushLocked();
+    bool appendBlock(const QString& filePath, const QVector<Event>& events) const;
+
+    QString getDay(qint64 time) const;                     // yyyy-MM-dd, UTC
+    typedef QPair<int, QPair<int, int> > RollupKey;   // kind, (user ID, object ID)
+
+    typedef QHash<QString, qint64> Manifest;          // segment file name -> its size
+
+    QVector<Event>          readSegment(const QString& filePath) const;
+    QHash<RollupKey, int>   readRollup (const QString& filePath, Manifest* manifest = 0) const;   // -> # of events
+    bool writeRollup(const QString& filePath, const QHash<RollupKey, int>& counts, const Manifest& manifest) const;
+
+private:
+    QMutex         _mutex;         // guards the buffer
+    QVector<Event> _buffer;        // events of one day, not written yet
+    QElapsedTimer  _sinceFlush;
+    int            _blockSize;     // max # of events per block
+    int            _flushInterval; // max ms an event stays in the buffer, checked on append and by a timer
+    int            _retention;     // days kept as events
+};
+
+#endif // EVENTLOG_H
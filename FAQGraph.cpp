@@ -0,0 +1,436 @@
+﻿#include "FAQGraph.h"
+#include "WriteEvent.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QVariant>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <algorithm>
+
+/**
+ * Add a value to a sorted vector, unless it's there already
+ * @return  - false if it was there
+ */
+static bool addSorted(QVector<int>& values, int value)
+{
+    QVector<int>::iterator it = std::lower_bound(values.begin(), values.end(), value);
+    if(it != values.end() && *it == value)
+        return false;
+    values.insert(it, value);
+    return true;
+}
+
+static void removeSorted(QVector<int>& values, int value)
+{
+    QVector<int>::iterator it = std::lower_bound(values.begin(), values.end(), value);
+    if(it != values.end() && *it == value)
+        values.erase(it);
+}
+
+/**
+ * Load the tables, in ID order, so that the indexes follow the IDs
+ * @return  - false if a table can't be read
+ */
+bool FAQGraph::load(QSqlDatabase database)
+{
+    QWriteLocker locker(&_lock);
+    QHash<int, int> apiOf, questionOf, answerOf, userOf;   // database ID -> index
+    QSqlQuery query(database);
+
+    if(!query.exec("select ID, Signature from APIs order by ID"))
+        return false;
+    while(query.next())
+    {
+        API api;
+        api.signature = query.value(1).toString();
+        apiOf.insert(query.value(0).toInt(), _apis.size());
+        _apiIndexes.insert(api.signature, _apis.size());
+        _signatures.insert(_apis.size(), api.signature);
+        _apis << api;
+    }
+
+    QHash<int, int> parentIDs;   // index -> parent's ID
+    if(!query.exec("select ID, Question, AskCount, Parent from Questions order by ID"))
+        return false;
+    while(query.next())
+    {
+        Question question;
+        question.text     = query.value(1).toString();
+        question.askCount = query.value(2).toInt();
+        question.parent   = -1;
+        parentIDs.insert(_questions.size(), query.value(3).toInt());
+        questionOf.insert(query.value(0).toInt(), _questions.size());
+        _questionIndexes.insert(question.text, _questions.size());
+        _questions << question;
+    }
+    for(QHash<int, int>::const_iterator it = parentIDs.constBegin(); it != parentIDs.constEnd(); ++it)
+        if(it.value() != -1)   // a child, of a missing question if the parent is unknown
+            setParent(it.key(), questionOf.value(it.value(), -2));
+
+    if(!query.exec("select ID, Link, Title from Answers order by ID"))
+        return false;
+    while(query.next())
+    {
+        Answer answer;
+        answer.link  = query.value(1).toString();
+        answer.title = query.value(2).toString();
+        answerOf.insert(query.value(0).toInt(), _answers.size());
+        _answerIndexes.insert(answer.link, _answers.size());
+        _answers << answer;
+    }
+
+    if(!query.exec("select ID, Name, Email from Users order by ID"))
+        return false;
+    while(query.next())
+    {
+        User user;
+        user.name  = query.value(1).toString();
+        user.email = query.value(2).toString();
+        userOf.insert(query.value(0).toInt(), _users.size());
+        _userIndexes.insert(user.name, _users.size());
+        _users << user;
+    }
+
+    // relations, skipping the rows whose ends are missing, as the joins do
+    if(!query.exec("select QuestionID, APIID from QuestionAboutAPI"))
+        return false;
+    while(query.next())
+    {
+        int question = questionOf.value(query.value(0).toInt(), -1);
+        int api      = apiOf     .value(query.value(1).toInt(), -1);
+        if(question >= 0 && api >= 0)
+        {
+            addSorted(_questions[question].apis, api);
+            addSorted(_apis[api].questions, question);
+        }
+    }
+
+    if(!query.exec("select QuestionID, AnswerID from AnswerToQuestion"))
+        return false;
+    while(query.next())
+    {
+        int question = questionOf.value(query.value(0).toInt(), -1);
+        int answer   = answerOf  .value(query.value(1).toInt(), -1);
+        if(question >= 0 && answer >= 0)
+        {
+            addSorted(_questions[question].answers, answer);
+            addSorted(_answers[answer].questions, question);
+        }
+    }
+
+    if(!query.exec("select QuestionID, UserID from UserAskQuestion \
+                    union \
+                    select QuestionID, UserID from UserReadAnswer"))
+        return false;
+    while(query.next())
+    {
+        int question = questionOf.value(query.value(0).toInt(), -1);
+        int user     = userOf    .value(query.value(1).toInt(), -1);
+        if(question >= 0 && user >= 0)
+            addUserQuestion(user, question);
+    }
+
+    _signatures.setLoaded();
+    return true;
+}
+
+/**
+ * Apply a write event, the way DAO::apply writes it
+ */
+void FAQGraph::apply(const WriteEvent& event)
+{
+    QWriteLocker locker(&_lock);
+    int user = updateUser(event.userName, event.email);
+    switch(event.type)
+    {
+    case WriteEvent::Save:
+    {
+        int api      = updateAPI   (event.apiSig);
+        int answer   = updateAnswer(event.link, event.title);
+        int question = updateQuestion(event.question);
+        if(question < 0)
+            break;
+        if(user >= 0)
+            addUserQuestion(user, question);
+        if(api >= 0)
+        {
+            addSorted(_questions[question].apis, api);
+            addSorted(_apis[api].questions, question);
+        }
+        if(answer >= 0)
+        {
+            addSorted(_questions[question].answers, answer);
+            addSorted(_answers[answer].questions, question);
+        }
+        break;
+    }
+    case WriteEvent::LogDocumentReading:   // reading history is not shown
+        updateAPI(event.apiSig);
+        break;
+    case WriteEvent::LogAnswerClicking:
+    {
+        // the reader of the answer's first question
+        int answer = _answerIndexes.value(event.link, -1);
+        if(user >= 0 && answer >= 0 && !_answers[answer].questions.isEmpty())
+            addUserQuestion(user, _answers[answer].questions.first());
+        break;
+    }
+    }
+}
+
+/**
+ * Apply DAO::onComparisonResult: the question becomes a child of the lead question
+ * An unknown lead makes it a lead, as the Parent it gets is -1
+ */
+void FAQGraph::merge(const QString& leadQuestion, const QString& question)
+{
+    QWriteLocker locker(&_lock);
+    int lead  = _questionIndexes.value(leadQuestion, -1);
+    int child = _questionIndexes.value(question,     -1);
+    if(lead < 0 || child < 0)
+        return;
+
+    // the question's whole group joins, under the lead's leader
+    int leader = _questions[lead] .parent >= 0 ? _questions[lead] .parent : lead;
+    int other  = _questions[child].parent >= 0 ? _questions[child].parent : child;
+    if(leader == other)
+        return;
+    QVector<int> children = _questions[other].children;
+    foreach(int member, children)
+        setParent(member, leader);
+    setParent(other, leader);
+}
+
+int FAQGraph::updateUser(const QString& name, const QString& email)
+{
+    if(name.isEmpty())
+        return -1;
+    int user = _userIndexes.value(name, -1);
+    if(user < 0)
+    {
+        user = _users.size();
+        _users << User();
+        _users[user].name = name;
+        _userIndexes.insert(name, user);
+    }
+    _users[user].email = email;
+    return user;
+}
+
+int FAQGraph::updateAPI(const QString& signature)
+{
+    if(signature.isEmpty())
+        return -1;
+    int api = _apiIndexes.value(signature, -1);
+    if(api < 0)
+    {
+        api = _apis.size();
+        _apis << API();
+        _apis[api].signature = signature;
+        _apiIndexes.insert(signature, api);
+        _signatures.insert(api, signature);
+    }
+    return api;
+}
+
+int FAQGraph::updateAnswer(const QString& link, const QString& title)
+{
+    if(link.isEmpty())
+        return -1;
+    int answer = _answerIndexes.value(link, -1);
+    if(answer < 0)
+    {
+        answer = _answers.size();
+        _answers << Answer();
+        _answers[answer].link = link;
+        _answerIndexes.insert(link, answer);
+    }
+    _answers[answer].title = title;
+    return answer;
+}
+
+/**
+ * Ask a question one more time, or for the first time
+ */
+int FAQGraph::updateQuestion(const QString& text)
+{
+    if(text.isEmpty())
+        return -1;
+    int question = _questionIndexes.value(text, -1);
+    if(question >= 0)
+    {
+        ++ _questions[question].askCount;
+        updateLead(question);
+        return question;
+    }
+
+    question = _questions.size();
+    _questions << Question();
+    _questions[question].text     = text;
+    _questions[question].askCount = 1;
+    _questions[question].parent   = -1;
+    _questionIndexes.insert(text, question);
+    return question;
+}
+
+/**
+ * The most asked of the group takes it over, if it has been asked more than the leader
+ * On a tie among the others, the first one
+ */
+void FAQGraph::updateLead(int question)
+{
+    int lead = _questions[question].parent >= 0 ? _questions[question].parent : question;
+    int best = -1;
+    foreach(int child, _questions[lead].children)
+        if(best < 0 || _questions[child].askCount > _questions[best].askCount)
+            best = child;
+    if(best < 0 || _questions[best].askCount <= _questions[lead].askCount)
+        return;
+
+    // the lead's children, and the lead itself, become best's children
+    QVector<int> children = _questions[lead].children;
+    foreach(int child, children)
+        if(child != best)
+            setParent(child, best);
+    setParent(lead, best);
+    setParent(best, -1);
+}
+
+/**
+ * @param parent    - index of the parent, -1 for none, -2 for a missing one
+ */
+void FAQGraph::setParent(int question, int parent)
+{
+    int oldParent = _questions[question].parent;
+    if(oldParent >= 0)
+        removeSorted(_questions[oldParent].children, question);
+    _questions[question].parent = parent;
+    if(parent >= 0)
+        addSorted(_questions[parent].children, question);
+}
+
+void FAQGraph::addUserQuestion(int user, int question)
+{
+    addSorted(_questions[question].users, user);
+    addSorted(_users[user].questions, question);
+}
+
+QJsonArray FAQGraph::queryFAQs(const QString& classSig) const
+{
+    QReadLocker locker(&_lock);
+    QJsonArray apisJson;
+    foreach(int api, _signatures.find(classSig).keys())
+    {
+        QJsonArray questions = createQuestionsJson(api);
+        if(questions.isEmpty())
+            continue;
+        QJsonObject apiJson;
+        apiJson.insert("apisig",    _apis[api].signature.section(";", -1, -1));   // remove library
+        apiJson.insert("questions", questions);
+        apisJson.append(apiJson);
+    }
+    return apisJson;
+}
+
+QJsonDocument FAQGraph::queryUserProfile(const QString& userName, int relatedLimit) const
+{
+    QReadLocker locker(&_lock);
+    int user = _userIndexes.value(userName, -1);
+    if(user < 0)
+        return QJsonDocument();
+
+    QJsonObject profileJson;
+    profileJson.insert("name",  userName);
+    profileJson.insert("email", _users[user].email);
+
+    // the APIs of the user's questions, and the other users of them, by # of questions shared
+    QVector<int>    apis;
+    QHash<int, int> shared;   // user -> # of questions
+    foreach(int question, _users[user].questions)
+    {
+        foreach(int api, _questions[question].apis)
+            addSorted(apis, api);
+        foreach(int other, _questions[question].users)
+            if(other != user)
+                ++ shared[other];
+    }
+
+    QJsonArray apisJson;
+    foreach(int api, apis)
+    {
+        QJsonObject apiJson;
+        apiJson.insert("apisig",    _apis[api].signature.section(";", -1, -1));
+        apiJson.insert("questions", createQuestionsJson(api));
+        apisJson.append(apiJson);
+    }
+    profileJson.insert("apis", apisJson);
+
+    QVector<QPair<int, int> > related;   // (-# shared, user), so that sorting puts the heaviest first
+    for(QHash<int, int>::const_iterator it = shared.constBegin(); it != shared.constEnd(); ++it)
+        related << qMakePair(-it.value(), it.key());
+    int count = qBound(0, relatedLimit, related.size());
+    std::partial_sort(related.begin(), related.begin() + count, related.end());
+
+    QJsonArray usersJson;
+    for(int i = 0; i < count; ++i)
+        usersJson.append(createUserJson(related[i].second));
+    profileJson.insert("relatedusers", usersJson);
+    return QJsonDocument(profileJson);
+}
+
+/**
+ * @return  - the lead questions of an API
+ */
+QJsonArray FAQGraph::createQuestionsJson(int api) const
+{
+    QJsonArray result;
+    foreach(int question, _apis[api].questions)
+        if(_questions[question].parent == -1)
+            result.append(createQuestionJson(question));
+    return result;
+}
+
+/**
+ * @return  - a question group: the lead question, with the users and answers of all its questions
+ */
+QJsonObject FAQGraph::createQuestionJson(int lead) const
+{
+    QVector<int> users   = _questions[lead].users;
+    QVector<int> answers = _questions[lead].answers;
+    foreach(int child, _questions[lead].children)
+    {
+        foreach(int user, _questions[child].users)
+            addSorted(users, user);
+        foreach(int answer, _questions[child].answers)
+            addSorted(answers, answer);
+    }
+
+    QJsonArray usersJson;
+    foreach(int user, users)
+        usersJson.append(createUserJson(user));
+
+    QJsonArray answersJson;
+    foreach(int answer, answers)
+    {
+        QJsonObject answerJson;
+        answerJson.insert("link",  _answers[answer].link);
+        answerJson.insert("title", _answers[answer].title);
+        answersJson.append(answerJson);
+    }
+
+    QJsonObject result;
+    result.insert("question", _questions[lead].text);
+    result.insert("users",    usersJson);
+    result.insert("answers",  answersJson);
+    return result;
+}
+
+QJsonObject FAQGraph::createUserJson(int user) const
+{
+    QJsonObject result;
+    result.insert("name",  _users[user].name);
+    result.insert("email", _users[user].email);
+    return result;
+}
@@ -0,0 +1,90 @@
+﻿#ifndef FAQGRAPH_H
+#define FAQGRAPH_H
+
+#include "SignatureIndex.h"
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QReadWriteLock>
+
+class QSqlDatabase;
+class QJsonArray;
+class QJsonObject;
+class QJsonDocument;
+struct WriteEvent;
+
+// The whole FAQ database in memory: APIs, questions, answers, users and their relations,
+// answering queryFAQs and queryUserProfile without SQL
+// Each kind of row is an array of structs, and the relations are arrays of indexes into them,
+// so a class page is a walk over a few small arrays. Rows are found by their natural keys,
+// the indexes are the graph's own and follow the database IDs' order, but are not the IDs.
+// Loaded from the database at startup, then write events are applied here as they are
+// accepted, while DAO persists them behind. It mirrors DAO's rules, which DAO::checkGraph verifies.
+// Thread safe
+class FAQGraph
+{
+public:
+    bool load(QSqlDatabase database);
+
+    void apply(const WriteEvent& event);                              // an accepted write
+    void merge(const QString& leadQuestion, const QString& question);   // a similar question's group joins the lead's
+
+    QJsonArray    queryFAQs       (const QString& classSig) const;
+    QJsonDocument queryUserProfile(const QString& userName, int relatedLimit) const;
+
+private:
+    struct API
+    {
+        QString      signature;
+        QVector<int> questions;   // about this API
+    };
+    struct Question
+    {
+        QString      text;
+        int          askCount;
+        int          parent;      // -1 for a lead
+        QVector<int> children;
+        QVector<int> apis;
+        QVector<int> answers;
+        QVector<int> users;       // who asked or viewed it
+    };
+    struct Answer
+    {
+        QString      link;
+        QString      title;
+        QVector<int> questions;
+    };
+    struct User
+    {
+        QString      name;
+        QString      email;
+        QVector<int> questions;   // asked or viewed
+    };
+
+    int updateUser    (const QString& name, const QString& email);   // locked, -1 if the key is empty
+    int updateAPI     (const QString& signature);
+    int updateAnswer  (const QString& link, const QString& title);
+    int updateQuestion(const QString& text);
+    void updateLead   (int question);
+    void setParent    (int question, int parent);
+    void addUserQuestion(int user, int question);
+
+    QJsonArray  createQuestionsJson(int api)  const;   // read locked
+    QJsonObject createQuestionJson (int lead) const;
+    QJsonObject createUserJson     (int user) const;
+
+private:
+    mutable QReadWriteLock _lock;
+    QVector<API>           _apis;
+    QVector<Question>      _questions;
+    QVector<Answer>        _answers;
+    QVector<User>          _users;
+    QHash<QString, int>    _apiIndexes;        // signature -> index
+    QHash<QString, int>    _questionIndexes;   // text      -> index
+    QHash<QString, int>    _answerIndexes;     // link      -> index
+    QHash<QString, int>    _userIndexes;       // name      -> index
+    SignatureIndex         _signatures;        // class signature -> API indexes
+};
+
+#endif // FAQGRAPH_H
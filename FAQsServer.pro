@@ -25,11 +25,59 @@ SOURCES = \
     Main.cpp \
     Template.cpp \
     SnippetCreator.cpp \
-    Settings.cpp
+    Settings.cpp \
+    RequestTask.cpp \
+    WriteBehindQueue.cpp \
+    SignalHandler.cpp \
+    StaticCache.cpp \
+    FileSender.cpp \
+    Compressor.cpp \
+    PhotoUpload.cpp \
+    AdmissionController.cpp \
+    Metrics.cpp \
+    Logger.cpp \
+    Tracer.cpp \
+    Supervisor.cpp \
+    WriteForwarder.cpp \
+    WriteReceiver.cpp \
+    Migrations.cpp \
+    SignatureIndex.cpp \
+    ResponseCache.cpp \
+    RelatedUsersGraph.cpp \
+    FAQGraph.cpp \
+    EventLog.cpp \
+    QuestionGroups.cpp \
+    QueryString.cpp
 HEADERS = \
     Server.h \
     DAO.h \
     SimilarityComparer.h \
     Template.h \
     SnippetCreator.h \
-    Settings.h
+    Settings.h \
+    Reply.h \
+    RequestTask.h \
+    WriteEvent.h \
+    WriteBehindQueue.h \
+    SignalHandler.h \
+    StaticCache.h \
+    FileSender.h \
+    Compressor.h \
+    PhotoUpload.h \
+    AdmissionController.h \
+    Metrics.h \
+    Logger.h \
+    Tracer.h \
+    Supervisor.h \
+    WriteForwarder.h \
+    WriteReceiver.h \
+    IDAllocator.h \
+    Migrations.h \
+    SignatureIndex.h \
+    FrequencySketch.h \
+    ResponseCache.h \
+    RelatedUsersGraph.h \
+    FAQGraph.h \
+    EventLog.h \
+    QuestionGroups.h \
+    QueryString.h
@@ -0,0 +1,78 @@
+﻿#include "FileSender.h"
+
+#include <qhttpresponse.h>
+#include <QTcpSocket>
+
+static const qint64 SliceSize      = 256 * 1024;
+static const qint64 HighWaterMark  = 2 * SliceSize;   // max bytes buffered in the socket
+
+FileSender::FileSender(QHttpResponse* res, QTcpSocket* socket, const QString& filePath,
+                       qint64 offset, qint64 length)
+    : QObject(res),   // goes away with the response
+      _response(res),
+      _socket(socket),
+      _file(filePath),
+      _map(0),
+      _length(length),
+      _sent(0)
+{
+    if(_file.open(QFile::ReadOnly) && length > 0)
+        _map = _file.map(offset, length);
+}
+
+FileSender::~FileSender()
+{
+    if(_map != 0)
+        _file.unmap(_map);
+}
+
+bool FileSender::start()
+{
+    if(_map == 0)
+        return false;
+
+    if(_socket != 0)
+    {
+        connect(_socket, SIGNAL(bytesWritten(qint64)), this, SLOT(sendSlices()));
+        connect(_socket, SIGNAL(disconnected()),       this, SLOT(abort()));
+    }
+    sendSlices();
+    return true;
+}
+
+/**
+ * Write slices until the socket buffer is full, or the whole range is sent
+ */
+void FileSender::sendSlices()
+{
+    if(_response == 0)
+        return abort();
+
+    while(_sent < _length && (_socket == 0 || _socket->bytesToWrite() < HighWaterMark))
+    {
+        qint64 size = qMin(SliceSize, _length - _sent);
+        // wraps the mapped memory, the socket copies it into its own buffer
+        _response->write(QByteArray::fromRawData(reinterpret_cast<const char*>(_map + _sent),
+                                                 static_cast<int>(size)));
+        _sent += size;
+    }
+
+    if(_sent == _length)
+    {
+        if(_socket != 0)
+            disconnect(_socket, 0, this, 0);
+        _response->end();
+        deleteLater();
+    }
+}
+
+/**
+ * The client is gone, stop sending
+ */
+void FileSender::abort()
+{
+    if(_socket != 0)
+        disconnect(_socket, 0, this, 0);
+    _sent = _length;
+    deleteLater();
+}
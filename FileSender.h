@@ -0,0 +1,39 @@
+﻿#ifndef FILESENDER_H
+#define FILESENDER_H
+
+#include "qhttpserverfwd.h"
+
+#include <QObject>
+#include <QFile>
+#include <QPointer>
+
+// Sends a (part of a) large file as the body of a response, without reading it into memory
+// The file is memory mapped and handed to the socket in slices. The next slice is
+// written only after the socket has drained the previous ones, so at most a couple of
+// slices are ever buffered, whatever the size of the file.
+// The response head, including Content-Length, must have been written already.
+// The sender deletes itself when it is done.
+class FileSender : public QObject
+{
+    Q_OBJECT
+
+public:
+    FileSender(QHttpResponse* res, QTcpSocket* socket, const QString& filePath,
+               qint64 offset, qint64 length);
+    ~FileSender();
+    bool start();   // false if the file can't be mapped
+
+private slots:
+    void sendSlices();
+    void abort();
+
+private:
+    QPointer<QHttpResponse> _response;
+    QPointer<QTcpSocket>    _socket;     // for pacing, null if it could not be found
+    QFile                   _file;
+    uchar*                  _map;
+    qint64                  _length;     // # of bytes to send
+    qint64                  _sent;       // # of bytes sent
+};
+
+#endif // FILESENDER_H
@@ -0,0 +1,71 @@
+﻿#ifndef FREQUENCYSKETCH_H
+#define FREQUENCYSKETCH_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+
+// Approximate access counts of recently used keys, for TinyLFU cache admission
+// A count-min sketch: each key has a counter in each of the rows, and its estimate is the
+// smallest of them. Counters saturate at 15, and are halved every sampleSize increments,
+// so that the counts follow the recent popularity, not the all time one.
+// Not thread safe
+class FrequencySketch
+{
+public:
+    FrequencySketch(int capacity)   // # of keys expected to be counted
+        : _additions(0)
+    {
+        _width = 16;
+        while(_width < capacity)
+            _width *= 2;
+        _counters.fill(0, Rows * _width);
+        _sampleSize = 10 * _width;
+    }
+
+    void increment(const QString& key)
+    {
+        bool added = false;
+        for(int row = 0; row < Rows; ++row)
+        {
+            quint8& counter = _counters[index(key, row)];
+            if(counter < 15)
+            {
+                ++counter;
+                added = true;
+            }
+        }
+        if(added && ++_additions >= _sampleSize)
+            age();
+    }
+
+    int estimate(const QString& key) const
+    {
+        int result = 15;
+        for(int row = 0; row < Rows; ++row)
+            result = qMin<int>(result, _counters[index(key, row)]);
+        return result;
+    }
+
+private:
+    int index(const QString& key, int row) const {
+        return row * _width + (qHash(key, 0x9e3779b9u * (row + 1)) & (_width - 1));   // a seed per row
+    }
+
+    void age()
+    {
+        for(int i = 0; i < _counters.size(); ++i)
+            _counters[i] >>= 1;
+        _additions /= 2;
+    }
+
+private:
+    enum {Rows = 4};
+
+    QVector<quint8> _counters;     // Rows x _width
+    int             _width;        // a power of 2
+    int             _sampleSize;
+    int             _additions;    // since the last aging
+};
+
+#endif // FREQUENCYSKETCH_H
@@ -0,0 +1,28 @@
+﻿#ifndef IDALLOCATOR_H
+#define IDALLOCATOR_H
+
+#include <QAtomicInt>
+
+// Hands out the IDs of one table, in memory, so an insert needs no select max(ID)
+// Seeded with max(ID) + 1 when DAO starts. Other processes may insert into the table too,
+// so an insert that collides raises the seed to the table's new max(ID) + 1, and tries again.
+// Thread safe, lock free
+class IDAllocator
+{
+public:
+    IDAllocator() : _next(0) {}
+
+    int allocate() { return _next.fetchAndAddRelaxed(1); }
+
+    // make the next ID at least next, never lower it, as other threads may have allocated past it
+    void raise(int next)
+    {
+        int current = _next.load();
+        while(current < next && !_next.testAndSetRelaxed(current, next, current)) {}
+    }
+
+private:
+    QAtomicInt _next;
+};
+
+#endif // IDALLOCATOR_H
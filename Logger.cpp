@@ -0,0 +1,178 @@
+﻿#include "Logger.h"
+#include "Settings.h"
+
+#include <QDateTime>
+#include <cstdio>
+
+Logger* Logger::getInstance()
+{
+    static Logger* instance = new Logger;   // initialized once, even if threads race to it
+    return instance;
+}
+
+Logger::Logger()
+    : _head(0)
+{
+    Settings* settings = Settings::getInstance();
+    _level      = parseLevel(settings->getLogLevel());
+    _sampleRate = settings->getLogSampleRate();
+
+    int size = 2;
+    while(size < settings->getLogBufferSize())
+        size *= 2;
+    _slots = QVector<Slot>(size);
+    _mask  = size - 1;
+    for(int i = 0; i < size; ++i)
+        _slots[i].sequence.store(i);
+
+    QString filePath = settings->getLogFile();
+    if(filePath.isEmpty())
+        _file.open(stderr, QIODevice::WriteOnly);
+    else
+    {
+        _file.setFileName(filePath);
+        _file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
+    }
+
+    start();
+}
+
+Logger::Level Logger::parseLevel(const QString& level)
+{
+    if(level == "debug")
+        return Debug;
+    if(level == "warning")
+        return Warning;
+    if(level == "error")
+        return Error;
+    return Info;
+}
+
+bool Logger::sample() {
+    return _sampleCounter.fetchAndAddRelaxed(1) % _sampleRate == 0;
+}
+
+/**
+ * Store a record for the flusher, lock free
+ * A producer claims a position by advancing _tail, fills the slot, then publishes it
+ * by setting its sequence, so the flusher never sees a half written record
+ */
+void Logger::log(Level level, const char* category, const QString& message)
+{
+    quint64 position = _tail.load();
+    Slot* slot;
+    for(;;)
+    {
+        slot = &_slots[static_cast<int>(position & _mask)];
+        qint64 diff = static_cast<qint64>(slot->sequence.loadAcquire() - position);
+        if(diff == 0)   // free, try to claim it
+        {
+            if(_tail.testAndSetRelaxed(position, position + 1, position))
+                break;
+        }
+        else if(diff < 0)   // the flusher has not read this slot yet, the buffer is full
+        {
+            _dropped.fetchAndAddRelaxed(1);
+            return;
+        }
+        else   // another producer claimed it
+            position = _tail.load();
+    }
+
+    slot->record.time     = QDateTime::currentMSecsSinceEpoch();
+    slot->record.level    = level;
+    slot->record.threadID = reinterpret_cast<quintptr>(QThread::currentThreadId());
+    slot->record.category = category;
+    slot->record.message  = message;
+    slot->sequence.storeRelease(position + 1);
+}
+
+/**
+ * Take the next published record, flusher only
+ * @return  - false if there is none
+ */
+bool Logger::take(Record& record)
+{
+    Slot& slot = _slots[static_cast<int>(_head & _mask)];
+    if(slot.sequence.loadAcquire() != _head + 1)
+        return false;
+
+    record = slot.record;
+    slot.record.message.clear();   // the copy shares the data, release it with the record
+    slot.sequence.storeRelease(_head + _mask + 1);   // free for the next lap
+    ++_head;
+    return true;
+}
+
+/**
+ * Format a record as one line, e.g.,
+ * 2016-03-01T12:00:00.123 INFO [7f3a] server listening port=8080
+ */
+void Logger::write(const Record& record)
+{
+    static const char* levels[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+    QString line = QString("%1 %2 [%3] %4 %5\n")
+            .arg(QDateTime::fromMSecsSinceEpoch(record.time).toString("yyyy-MM-ddThh:mm:ss.zzz"))
+            .arg(levels[record.level])
+            .arg(record.threadID, 0, 16)
+            .arg(record.category)
+            .arg(record.message);
+    _file.write(line.toUtf8());
+}
+
+void Logger::run()
+{
+    Record record;
+    for(;;)
+    {
+        bool stopping = _stopping.loadAcquire();   // read before draining, so nothing is left behind
+        int count = 0;
+        while(take(record))
+        {
+            write(record);
+            ++count;
+        }
+
+        quint64 dropped = _dropped.fetchAndStoreRelaxed(0);
+        if(dropped > 0)
+            _file.write(QString("%1 WARNING logger dropped %2 records, buffer full\n")
+                        .arg(QDateTime::currentDateTime().toString("yyyy-MM-ddThh:mm:ss.zzz"))
+                        .arg(dropped).toUtf8());
+        if(count > 0 || dropped > 0)
+            _file.flush();
+
+        if(stopping)
+            break;
+        if(count == 0)   // the producers do not signal, to stay lock free, so poll
+            msleep(20);
+    }
+}
+
+/**
+ * Write all pending records and end the flusher
+ */
+void Logger::stop()
+{
+    _stopping.storeRelease(1);
+    wait();
+}
+
+/**
+ * Route qDebug(), qWarning() etc., including Qt's own, through the logger
+ * Install with qInstallMessageHandler()
+ */
+void Logger::handleQtMessage(QtMsgType type, const QMessageLogContext&, const QString& message)
+{
+    Level level = type == QtDebugMsg   ? Debug
+                : type == QtWarningMsg ? Warning
+                : type == QtInfoMsg    ? Info
+                                       : Error;
+    Logger* logger = getInstance();
+    if(type == QtFatalMsg)   // about to abort, there is no time for the flusher
+    {
+        fprintf(stderr, "%s\n", qPrintable(message));
+        return;
+    }
+    if(logger->isEnabled(level))
+        logger->log(level, "qt", message);
+}
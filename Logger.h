@@ -0,0 +1,88 @@
+﻿#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <QThread>
+#include <QAtomicInteger>
+#include <QString>
+#include <QVector>
+#include <QFile>
+
+// Leveled logger that keeps formatting and I/O off the request threads
+// A log call stores a record in a bounded lock-free ring buffer (many producers, one consumer),
+// and a flusher thread formats and writes the records. When the buffer is full, records are
+// dropped and counted, a log call never blocks.
+// Use the LOG_* macros, which skip evaluating the message when its level is disabled.
+// LOG_DEBUG and LOG_PAYLOAD compile to nothing in release builds, and LOG_PAYLOAD,
+// for dumping whole documents, only logs 1 in LogSampleRate calls
+class Logger : public QThread
+{
+public:
+    enum Level {Debug, Info, Warning, Error};
+
+    static Logger* getInstance();
+
+    bool isEnabled(Level level) const { return level >= _level; }
+    bool sample();   // true for 1 in LogSampleRate calls
+    void log(Level level, const char* category, const QString& message);
+    void stop();     // write all pending records and end the flusher
+
+    static void handleQtMessage(QtMsgType type, const QMessageLogContext& context, const QString& message);
+
+protected:
+    void run();
+
+private:
+    struct Record
+    {
+        qint64      time;       // ms since epoch
+        Level       level;
+        quintptr    threadID;
+        const char* category;   // a string literal
+        QString     message;
+    };
+
+    struct Slot
+    {
+        QAtomicInteger<quint64> sequence;   // == position + 1 when the record at position is ready
+        Record                  record;
+    };
+
+private:
+    Logger();
+    bool take(Record& record);   // consumer side
+    void write(const Record& record);
+
+    static Level parseLevel(const QString& level);
+
+private:
+    QVector<Slot>           _slots;
+    quint64                 _mask;        // # of slots - 1
+    QAtomicInteger<quint64> _tail;        // next position to claim, shared by the producers
+    quint64                 _head;        // next position to read, flusher only
+    QAtomicInteger<quint64> _dropped;     // records lost to a full buffer
+    QAtomicInteger<quint64> _sampleCounter;
+    QAtomicInt              _stopping;
+
+    Level _level;
+    int   _sampleRate;
+    QFile _file;
+};
+
+#define LOG_AT(level, category, message) \
+    do { if(Logger::getInstance()->isEnabled(level)) Logger::getInstance()->log(level, category, message); } while(0)
+
+#define LOG_INFO(category, message)    LOG_AT(Logger::Info,    category, message)
+#define LOG_WARNING(category, message) LOG_AT(Logger::Warning, category, message)
+#define LOG_ERROR(category, message)   LOG_AT(Logger::Error,   category, message)
+
+#ifdef QT_NO_DEBUG
+#define LOG_DEBUG(category, message)   do {} while(0)
+#define LOG_PAYLOAD(category, message) do {} while(0)
+#else
+#define LOG_DEBUG(category, message)   LOG_AT(Logger::Debug, category, message)
+#define LOG_PAYLOAD(category, message) \
+    do { if(Logger::getInstance()->isEnabled(Logger::Debug) && Logger::getInstance()->sample()) \
+             Logger::getInstance()->log(Logger::Debug, category, message); } while(0)
+#endif
+
+#endif // LOGGER_H
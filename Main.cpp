@@ -1,9 +1,34 @@
 #include "Server.h"
+#include "SignalHandler.h"
+#include "Logger.h"
+#include "Settings.h"
+#include "Supervisor.h"
 #include <QCoreApplication>
+#include <csignal>
 
 int main(int argc, char **argv)
 {
+    // fork the worker processes, if any, before Qt starts any thread
+    Supervisor supervisor(Settings::getInstance()->getProcesses());
+    if(!supervisor.run())
+        return 0;   // the supervisor, its workers are gone
+
     QCoreApplication app(argc, argv);
-    Server server;
-    app.exec();
+    qInstallMessageHandler(Logger::handleQtMessage);
+
+    {
+        Server server(supervisor.getWorker(), supervisor.getGeneration());
+        supervisor.notifyReady();
+
+        // on Ctrl+C or kill, stop accepting and finish the open requests, then Server drains pending writes
+        SignalHandler signalHandler;
+        signalHandler.watch(SIGINT);
+        signalHandler.watch(SIGTERM);
+        QObject::connect(&signalHandler, SIGNAL(signalReceived(int)), &server, SLOT(shutdown()));
+
+        app.exec();
+    }   // the server's shutdown may still log
+
+    qInstallMessageHandler(0);
+    Logger::getInstance()->stop();
 }
@@ -0,0 +1,189 @@
+﻿#include "Metrics.h"
+
+#include <QMutexLocker>
+#include <QMap>
+#include <QStringList>
+#include <QVector>
+#include <QtAlgorithms>
+
+Metrics* Metrics::getInstance()
+{
+    static Metrics* instance = new Metrics;
+    return instance;
+}
+
+Metrics::Metrics() {}
+
+int Metrics::getHistogram(const QString& name, const QString& labels) {
+    return getSeries(name, labels, true);
+}
+
+int Metrics::getCounter(const QString& name, const QString& labels) {
+    return getSeries(name, labels, false);
+}
+
+/**
+ * Find or register a series
+ * @return  - id of the series, or -1 if there are too many
+ */
+int Metrics::getSeries(const QString& name, const QString& labels, bool isHistogram)
+{
+    QMutexLocker locker(&_mutex);
+    int count = _seriesCount.loadAcquire();
+    for(int i = 0; i < count; ++i)
+        if(_series[i].name == name && _series[i].labels == labels)
+            return i;
+
+    if(count == MaxSeries)
+        return -1;
+
+    _series[count].name        = name;
+    _series[count].labels      = labels;
+    _series[count].isHistogram = isHistogram;
+    _seriesCount.storeRelease(count + 1);
+    return count;
+}
+
+/**
+ * @return  - the shard of the current thread, created on first use
+ */
+Metrics::Shard* Metrics::getShard()
+{
+    if(_shardIndex.hasLocalData())
+        return _shards[_shardIndex.localData() - 1].load();
+
+    QMutexLocker locker(&_mutex);   // once per thread
+    int index = _shardCount.load();
+    if(index == MaxShards)
+        return 0;
+    _shards[index].store(new Shard);
+    _shardCount.storeRelease(index + 1);
+    _shardIndex.setLocalData(index + 1);
+    return _shards[index].load();
+}
+
+/**
+ * Record a value, lock free
+ * @param histogram     - id of the histogram
+ * @param microseconds  - the value
+ */
+void Metrics::observe(int histogram, qint64 microseconds)
+{
+    Shard* shard = getShard();
+    if(histogram < 0 || shard == 0)
+        return;
+
+    HistogramData* data = shard->histograms[histogram].load();
+    if(data == 0)   // only this thread writes to its shard, so no race here
+    {
+        data = new HistogramData;   // atomics start at 0
+        shard->histograms[histogram].storeRelease(data);
+    }
+    data->buckets[getBucket(qMax<qint64>(microseconds, 0))].fetchAndAddRelaxed(1);
+    data->sum.fetchAndAddRelaxed(qMax<qint64>(microseconds, 0));
+}
+
+/**
+ * Increase a counter, lock free
+ */
+void Metrics::add(int counter, qint64 amount)
+{
+    Shard* shard = getShard();
+    if(counter >= 0 && shard != 0)
+        shard->counters[counter].fetchAndAddRelaxed(amount);
+}
+
+/**
+ * Values under 8 us have a bucket each, then each power of 2 is split in 8 sub-buckets
+ */
+int Metrics::getBucket(qint64 microseconds)
+{
+    if(microseconds < 8)
+        return static_cast<int>(microseconds);
+    int exponent = 63 - qCountLeadingZeroBits(static_cast<quint64>(microseconds));   // >= 3
+    int mantissa = static_cast<int>(microseconds >> (exponent - 3)) & 7;
+    return qMin(8 + (exponent - 3) * 8 + mantissa, BucketCount - 1);
+}
+
+qint64 Metrics::getBucketLimit(int bucket)
+{
+    if(bucket < 8)
+        return bucket + 1;
+    int exponent = (bucket - 8) / 8 + 3;
+    int mantissa = (bucket - 8) % 8;
+    return static_cast<qint64>(9 + mantissa) << (exponent - 3);
+}
+
+/**
+ * Export all series in Prometheus text format
+ * Histograms are reported at fixed boundaries, from 100 us to 10 s;
+ * a bucket counts toward a boundary if its upper bound is within it
+ */
+QByteArray Metrics::toPrometheus() const
+{
+    static const qint64 boundaries[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+                                        100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+    static const int boundaryCount = sizeof(boundaries) / sizeof(boundaries[0]);
+
+    int seriesCount = _seriesCount.loadAcquire();
+    int shardCount  = _shardCount .loadAcquire();
+
+    // group the series by name, Prometheus wants one TYPE line per metric
+    QMap<QString, QList<int> > byName;
+    for(int i = 0; i < seriesCount; ++i)
+        byName[_series[i].name] << i;
+
+    QByteArray result;
+    for(QMap<QString, QList<int> >::ConstIterator it = byName.begin(); it != byName.end(); ++it)
+    {
+        const QString& name = it.key();
+        bool isHistogram = _series[it.value().first()].isHistogram;
+        result += "# TYPE " + name.toUtf8() + (isHistogram ? " histogram\n" : " counter\n");
+
+        foreach(int id, it.value())
+        {
+            const QString& labels = _series[id].labels;
+            QString prefix = labels.isEmpty() ? QString() : labels + ",";
+
+            if(!isHistogram)
+            {
+                qint64 total = 0;
+                for(int s = 0; s < shardCount; ++s)
+                    total += _shards[s].load()->counters[id].load();
+                result += QString("%1%2 %3\n").arg(name)
+                          .arg(labels.isEmpty() ? QString() : "{" + labels + "}")
+                          .arg(total).toUtf8();
+                continue;
+            }
+
+            // merge the shards
+            QVector<quint64> buckets(BucketCount, 0);
+            quint64 sum = 0;
+            for(int s = 0; s < shardCount; ++s)
+                if(HistogramData* data = _shards[s].load()->histograms[id].loadAcquire())
+                {
+                    for(int b = 0; b < BucketCount; ++b)
+                        buckets[b] += data->buckets[b].load();
+                    sum += data->sum.load();
+                }
+
+            quint64 cumulative = 0;
+            int     bucket     = 0;
+            for(int i = 0; i < boundaryCount; ++i)
+            {
+                for(; bucket < BucketCount && getBucketLimit(bucket) <= boundaries[i]; ++bucket)
+                    cumulative += buckets[bucket];
+                result += QString("%1_bucket{%2le=\"%3\"} %4\n")
+                          .arg(name).arg(prefix).arg(boundaries[i] / 1e6).arg(cumulative).toUtf8();
+            }
+            for(; bucket < BucketCount; ++bucket)
+                cumulative += buckets[bucket];
+            result += QString("%1_bucket{%2le=\"+Inf\"} %3\n").arg(name).arg(prefix).arg(cumulative).toUtf8();
+
+            QString suffixLabels = labels.isEmpty() ? QString() : "{" + labels + "}";
+            result += QString("%1_sum%2 %3\n")  .arg(name).arg(suffixLabels).arg(sum / 1e6, 0, 'f', 6).toUtf8();
+            result += QString("%1_count%2 %3\n").arg(name).arg(suffixLabels).arg(cumulative).toUtf8();
+        }
+    }
+    return result;
+}
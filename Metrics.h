@@ -0,0 +1,85 @@
+﻿#ifndef METRICS_H
+#define METRICS_H
+
+#include <QString>
+#include <QByteArray>
+#include <QMutex>
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QThreadStorage>
+#include <QElapsedTimer>
+
+// Latency histograms and counters, exported in Prometheus text format
+// A series (e.g., faqs_request_duration_seconds{action="query"}) is registered once,
+// and recorded by its id. Each thread records into its own shard, with relaxed atomic
+// adds on memory no other thread writes, so recording takes no lock and shares no cache line.
+// Exporting sums the shards.
+// Histograms are HDR-style: 8 linear sub-buckets per power of 2 microseconds,
+// i.e., values are kept within 12.5%, from 1 us to about 12 days
+class Metrics
+{
+public:
+    static Metrics* getInstance();
+
+    // find or register a series, labels are in Prometheus syntax, e.g., action="query"
+    int getHistogram(const QString& name, const QString& labels = QString());
+    int getCounter  (const QString& name, const QString& labels = QString());
+
+    void observe(int histogram, qint64 microseconds);
+    void add    (int counter,   qint64 amount = 1);
+
+    QByteArray toPrometheus() const;
+
+public:
+    enum {MaxSeries = 512, MaxShards = 256, BucketCount = 8 + 40 * 8};
+
+private:
+    struct Series
+    {
+        QString name;
+        QString labels;
+        bool    isHistogram;
+    };
+
+    struct HistogramData
+    {
+        QAtomicInteger<quint64> buckets[BucketCount];
+        QAtomicInteger<quint64> sum;   // microseconds
+    };
+
+    struct Shard   // the series recorded by one thread
+    {
+        QAtomicPointer<HistogramData> histograms[MaxSeries];   // allocated on first observation
+        QAtomicInteger<qint64>        counters  [MaxSeries];
+    };
+
+private:
+    Metrics();
+    int    getSeries(const QString& name, const QString& labels, bool isHistogram);
+    Shard* getShard();
+
+    static int    getBucket     (qint64 microseconds);
+    static qint64 getBucketLimit(int bucket);   // exclusive upper bound of a bucket
+
+private:
+    mutable QMutex        _mutex;                  // guards registration
+    Series                _series[MaxSeries];
+    QAtomicInt            _seriesCount;            // published after the series is filled in
+    QAtomicPointer<Shard> _shards[MaxShards];
+    QAtomicInt            _shardCount;
+    QThreadStorage<int>   _shardIndex;             // this thread's shard, 0 if none, otherwise index + 1
+};
+
+// Records the lifetime of a scope into a histogram
+class LatencyTimer
+{
+public:
+    LatencyTimer(int histogram) : _histogram(histogram) { _timer.start(); }
+    ~LatencyTimer() { Metrics::getInstance()->observe(_histogram, _timer.nsecsElapsed() / 1000); }
+
+private:
+    int           _histogram;
+    QElapsedTimer _timer;
+};
+
+#endif // METRICS_H
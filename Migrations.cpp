@@ -0,0 +1,376 @@
+﻿#include "Migrations.h"
+#include "Logger.h"
+#include "EventLog.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QObject>
+#include <QUrl>
+#include <QPair>
+#include <QStringList>
+
+// step i brings the database to version i + 1
+const Migrations::Step Migrations::_steps[] = {
+    &Migrations::createTables,
+    &Migrations::createIndexes,
+    &Migrations::convertTimes,
+    &Migrations::createInvalidations,
+    &Migrations::createProfiles,
+    &Migrations::moveHistory,
+    &Migrations::groupQuestions,
+    &Migrations::decodeKeys,
+    &Migrations::logGroupChanges
+};
+const char* Migrations::_descriptions[] = {
+    "create tables",
+    "index the join columns",
+    "store times as integer epochs",
+    "log the APIs whose FAQs changed",
+    "aggregate user profiles",
+    "move the reading history to the event log",
+    "point every question to its group's lead",
+    "percent-decode the stored keys",
+    "log the questions whose group rows changed"
+};
+
+int Migrations::getLatestVersion() {
+    return sizeof(_steps) / sizeof(_steps[0]);
+}
+
+/**
+ * Apply the missing steps
+ * @return  - false if a step failed, the database is left at the version before it
+ */
+bool Migrations::run(QSqlDatabase database, int target)
+{
+    exec(database, "create table if not exists schema_version (Version int not null)");
+
+    if(target < 0 || target > getLatestVersion())
+        target = getLatestVersion();
+
+    // events staged by a step that committed, but whose process died before publishing them
+    EventLog* eventLog = EventLog::getInstance();
+    foreach(const QString& tag, eventLog->getStagedTags())
+        if(tag.toInt() <= getVersion(database))
+            eventLog->publishStaged(tag);
+
+    for(int version = getVersion(database); version < target; version = getVersion(database))
+    {
+        // take the write lock first, so that the version can't change under us
+        if(!exec(database, "begin immediate"))
+            return false;
+
+        if(getVersion(database) != version)   // another process got here first
+        {
+            exec(database, "rollback");
+            continue;
+        }
+
+        // staged by a step that failed, or died, before; no other process is in a step now
+        QString tag = QString::number(version + 1);
+        eventLog->discardStaged(tag);
+
+        bool ok = _steps[version](database) &&
+                  exec(database, "delete from schema_version") &&
+                  exec(database, QObject::tr("insert into schema_version values (%1)").arg(version + 1));
+        if(!ok || !exec(database, "commit"))
+        {
+            exec(database, "rollback");
+            eventLog->discardStaged(tag);
+            LOG_ERROR("migrations", QObject::tr("failed version=%1 step=\"%2\"").arg(version + 1).arg(_descriptions[version]));
+            return false;
+        }
+        eventLog->publishStaged(tag);   // a step's events are part of the log once it has committed
+        LOG_INFO("migrations", QObject::tr("migrated version=%1 step=\"%2\"").arg(version + 1).arg(_descriptions[version]));
+    }
+    return true;
+}
+
+int Migrations::getVersion(QSqlDatabase& database)
+{
+    QSqlQuery query(database);
+    query.exec("select max(Version) from schema_version");
+    return query.next() ? query.value(0).toInt() : 0;
+}
+
+bool Migrations::exec(QSqlDatabase& database, const QString& sql)
+{
+    QSqlQuery query(database);
+    if(query.exec(sql))
+        return true;
+    LOG_ERROR("migrations", QObject::tr("%1: %2").arg(query.lastError().text()).arg(sql.simplified()));
+    return false;
+}
+
+/**
+ * The original schema. Databases created before versioning have these tables already
+ */
+bool Migrations::createTables(QSqlDatabase& database)
+{
+    return exec(database, "create table if not exists APIs ( \
+               ID        int primary key, \
+               Signature varchar unique not null)") &&   // e.g., lib;package.class.method
+           exec(database, "create table if not exists Answers ( \
+               ID    int primary key, \
+               Link  varchar unique not null, \
+               Title varchar        not null)") &&
+           exec(database, "create table if not exists Users ( \
+               ID    int primary key, \
+               Name  varchar unique not null, \
+               Email varchar unique)") &&
+           exec(database, "create table if not exists Questions ( \
+               ID         int primary key, \
+               Question   varchar unique not null, \
+               AskCount   int, \
+               Parent     int)") &&
+           exec(database, "create table if not exists UserAskQuestion ( \
+               QuestionID int references Questions(ID) on delete cascade on update cascade, \
+               UserID     int references Users    (ID) on delete cascade on update cascade, \
+               primary key (QuestionID, UserID))") &&
+           exec(database, "create table if not exists QuestionAboutAPI ( \
+               QuestionID int references Questions(ID) on delete cascade on update cascade, \
+               APIID      int references APIs     (ID) on delete cascade on update cascade, \
+               primary key (QuestionID, APIID))") &&
+           exec(database, "create table if not exists AnswerToQuestion ( \
+               QuestionID int references Questions(ID) on delete cascade on update cascade, \
+               AnswerID   int references Answers  (ID) on delete cascade on update cascade, \
+               primary key (QuestionID, AnswerID))") &&
+           exec(database, "create table if not exists UserReadDocument ( \
+               UserID int references Users(ID) on delete cascade on update cascade, \
+               APIID  int references APIs (ID) on delete cascade on update cascade, \
+               Time   varchar, \
+               primary key (UserID, APIID, Time))") &&
+           exec(database, "create table if not exists UserReadAnswer ( \
+               UserID     int references Users    (ID) on delete cascade on update cascade, \
+               QuestionID int references Questions(ID) on delete cascade on update cascade, \
+               Time       varchar, \
+               primary key (UserID, QuestionID, Time))");
+}
+
+/**
+ * Covering indexes for the lookups that don't lead with a primary key column:
+ * - the lead questions of an API: QuestionAboutAPI by APIID, then Questions by Parent
+ * - the questions of a group: Questions by Parent
+ * - the questions of an answer: AnswerToQuestion by AnswerID
+ * - the questions of a user: UserAskQuestion by UserID
+ * - the readers of a question: UserReadAnswer by QuestionID
+ */
+bool Migrations::createIndexes(QSqlDatabase& database)
+{
+    return exec(database, "create index if not exists QuestionAboutAPIByAPI    on QuestionAboutAPI(APIID, QuestionID)") &&
+           exec(database, "create index if not exists QuestionsByParent        on Questions(Parent, ID)") &&
+           exec(database, "create index if not exists AnswerToQuestionByAnswer on AnswerToQuestion(AnswerID, QuestionID)") &&
+           exec(database, "create index if not exists UserAskQuestionByUser    on UserAskQuestion(UserID, QuestionID)") &&
+           exec(database, "create index if not exists UserReadAnswerByQuestion on UserReadAnswer(QuestionID, UserID)");
+}
+
+/**
+ * Time was stored as local "yyyy-MM-dd hh:mm:ss" text, it becomes seconds since the epoch
+ * SQLite can't change a column's type, so the tables are rebuilt.
+ * A time strftime can't parse becomes 0 rather than dropping its row. Rows that then have the
+ * same key are kept once; both are logged, nothing is lost silently
+ */
+bool Migrations::convertTimes(QSqlDatabase& database)
+{
+    if(!exec(database, "create table UserReadDocumentNew ( \
+               UserID int references Users(ID) on delete cascade on update cascade, \
+               APIID  int references APIs (ID) on delete cascade on update cascade, \
+               Time   int not null, \
+               primary key (UserID, APIID, Time))") ||
+       !exec(database, "create table UserReadAnswerNew ( \
+               UserID     int references Users    (ID) on delete cascade on update cascade, \
+               QuestionID int references Questions(ID) on delete cascade on update cascade, \
+               Time       int not null, \
+               primary key (UserID, QuestionID, Time))"))
+        return false;
+
+    QStringList tables;   // table, its object column
+    tables << "UserReadDocument" << "APIID" << "UserReadAnswer" << "QuestionID";
+    for(int i = 0; i < tables.size(); i += 2)
+    {
+        QString table  = tables[i];
+        QString object = tables[i + 1];
+        QSqlQuery query(database);
+        if(!query.exec(QObject::tr("select count(*), count(strftime('%s', Time, 'utc')) from %1").arg(table)) || !query.next())
+            return false;
+        int rows        = query.value(0).toInt();
+        int unparseable = rows - query.value(1).toInt();
+        query.finish();
+
+        if(!exec(database, QObject::tr("insert into %1New \
+                     select distinct UserID, %2, coalesce(cast(strftime('%s', Time, 'utc') as int), 0) from %1")
+                     .arg(table).arg(object)) ||
+           !query.exec(QObject::tr("select count(*) from %1New").arg(table)) || !query.next())
+            return false;
+        int merged = rows - query.value(0).toInt();
+        query.finish();
+
+        if(unparseable > 0 || merged > 0)
+            LOG_WARNING("migrations", QObject::tr("converting times table=%1 unparseable=%2 (stored as 0) merged=%3")
+                                      .arg(table).arg(unparseable).arg(merged));
+        if(!exec(database, "drop table " + table) ||
+           !exec(database, QObject::tr("alter table %1New rename to %1").arg(table)))
+            return false;
+    }
+    return exec(database, "create index UserReadAnswerByQuestion on UserReadAnswer(QuestionID, UserID)");
+}
+
+/**
+ * The API signatures whose FAQs a write changed, for the caches of rendered FAQs, in every process
+ * Written in the same transaction as the change, so a cache never drops an entry for a write
+ * that rolled back, nor misses one that committed. IDs are consecutive, old rows are pruned
+ */
+bool Migrations::createInvalidations(QSqlDatabase& database)
+{
+    return exec(database, "create table if not exists Invalidations ( \
+               ID        integer primary key, \
+               Signature varchar not null)");
+}
+
+/**
+ * Per user aggregates, maintained by DAO as the history grows, so that a profile is read by user
+ * - UserQuestions: the questions a user asked or viewed, once, however many times she did
+ * - UserAPIs:      the APIs of those questions
+ * - UserRelated:   the other users of those questions, with the # of questions they share
+ * Backfilled from the history
+ */
+bool Migrations::createProfiles(QSqlDatabase& database)
+{
+    return exec(database, "create table if not exists UserQuestions ( \
+               UserID     int references Users    (ID) on delete cascade on update cascade, \
+               QuestionID int references Questions(ID) on delete cascade on update cascade, \
+               primary key (UserID, QuestionID))") &&
+           exec(database, "create index if not exists UserQuestionsByQuestion on UserQuestions(QuestionID, UserID)") &&
+           exec(database, "insert or ignore into UserQuestions \
+               select UserID, QuestionID from UserAskQuestion \
+               union \
+               select UserID, QuestionID from UserReadAnswer") &&
+
+           exec(database, "create table if not exists UserAPIs ( \
+               UserID int references Users(ID) on delete cascade on update cascade, \
+               APIID  int references APIs (ID) on delete cascade on update cascade, \
+               primary key (UserID, APIID))") &&
+           exec(database, "insert or ignore into UserAPIs \
+               select distinct UserID, APIID from UserQuestions U, QuestionAboutAPI R \
+               where R.QuestionID = U.QuestionID") &&
+
+           exec(database, "create table if not exists UserRelated ( \
+               UserID  int references Users(ID) on delete cascade on update cascade, \
+               OtherID int references Users(ID) on delete cascade on update cascade, \
+               Shared  int not null, \
+               primary key (UserID, OtherID))") &&
+           exec(database, "create index if not exists UserRelatedByOther on UserRelated(OtherID, UserID)") &&
+           exec(database, "insert or ignore into UserRelated \
+               select U.UserID, O.UserID, count(*) from UserQuestions U, UserQuestions O \
+               where O.QuestionID = U.QuestionID and O.UserID != U.UserID \
+               group by U.UserID, O.UserID");
+}
+
+/**
+ * The reading history goes to EventLog. UserReadDocument is not read by any query, and is dropped;
+ * UserReadAnswer keeps the first read of each question by each user, which makes her its user
+*/
+bool Migrations::moveHistory(QSqlDatabase& database)
+{
+    QVector<EventLog::Event> events;
+    QSqlQuery query(database);
+    if(!query.exec("select UserID, APIID, Time from UserReadDocument order by Time"))
+        return false;
+    while(query.next())
+    {
+        EventLog::Event event = {query.value(2).toLongLong(), EventLog::ReadDocument,
+                                 query.value(0).toInt(), query.value(1).toInt()};
+        events << event;
+    }
+
+    if(!query.exec("select UserID, QuestionID, Time from UserReadAnswer order by Time"))
+        return false;
+    while(query.next())
+    {
+        EventLog::Event event = {query.value(2).toLongLong(), EventLog::ClickAnswer,
+                                 query.value(0).toInt(), query.value(1).toInt()};
+        events << event;
+    }
+    query.finish();   // or the select keeps the table busy
+
+    // staged, and published by run() only after the step commits, so a failed step leaves no events
+    if(!EventLog::getInstance()->stage(QString::number(getVersion(database) + 1), events))
+        return false;
+
+    return exec(database, "drop table UserReadDocument") &&
+           exec(database, "delete from UserReadAnswer where rowid not in \
+               (select min(rowid) from UserReadAnswer group by UserID, QuestionID)");
+}
+
+/**
+ * A question merged into another group used to leave its children behind, pointing to it.
+ * Every chain is flattened, so that each group is its lead and the lead's children.
+ * GroupVersion is bumped with every change to the groups, for the writers to notice the ones
+ * they didn't make
+ */
+bool Migrations::groupQuestions(QSqlDatabase& database)
+{
+    return exec(database, "with recursive Leads(ID, Lead) as ( \
+                   select ID, ID from Questions where Parent = -1 \
+                   union \
+                   select Q.ID, L.Lead from Questions Q, Leads L where Q.Parent = L.ID and Q.ID <> L.Lead) \
+               update Questions set Parent = (select Lead from Leads where Leads.ID = Questions.ID) \
+               where Parent <> -1 and ID in (select ID from Leads)") &&
+           exec(database, "create table if not exists GroupVersion (Version int not null)") &&
+           exec(database, "insert into GroupVersion values (0)");
+}
+
+/**
+ * Request parameters used to be decoded by QUrl's pretty decoding only, which keeps reserved
+ * chars encoded, e.g., & as %26, and were stored so, except links and titles.
+ * They are fully decoded now, so the stored names, emails, signatures and questions are too.
+ * A key whose decoded form is stored already is left as it is
+ */
+bool Migrations::decodeKeys(QSqlDatabase& database)
+{
+    QStringList columns;   // table.column
+    columns << "Users.Name" << "Users.Email" << "APIs.Signature" << "Questions.Question";
+    foreach(const QString& column, columns)
+    {
+        QString table = column.section('.', 0, 0);
+        QString name  = column.section('.', 1, 1);
+
+        QList<QPair<int, QString> > decoded;   // ID -> decoded key
+        QSqlQuery query(database);
+        if(!query.exec(QObject::tr("select ID, %1 from %2 where instr(%1, '%')").arg(name).arg(table)))
+            return false;
+        while(query.next())
+        {
+            QString key   = query.value(1).toString();
+            QString value = QUrl::fromPercentEncoding(key.toUtf8());
+            if(value != key)
+                decoded << qMakePair(query.value(0).toInt(), value);
+        }
+        query.finish();
+
+        query.prepare(QObject::tr("update or ignore %1 set %2 = :value where ID = :id").arg(table).arg(name));
+        for(int i = 0; i < decoded.size(); ++i)
+        {
+            query.bindValue(":value", decoded[i].second);
+            query.bindValue(":id",    decoded[i].first);
+            if(!query.exec())
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * GroupVersion only told the writers that the groups had changed, and they reloaded all of them.
+ * GroupChanges logs the questions whose rows changed instead, for the writers to re-read those.
+ * Its ID is the version: writers are serialized, so it grows in commit order
+ */
+bool Migrations::logGroupChanges(QSqlDatabase& database)
+{
+    return exec(database, "create table if not exists GroupChanges ( \
+               ID         integer primary key autoincrement, \
+               QuestionID int not null)") &&
+           exec(database, "drop table if exists GroupVersion");
+}
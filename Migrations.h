@@ -0,0 +1,40 @@
+﻿#ifndef MIGRATIONS_H
+#define MIGRATIONS_H
+
+#include <QString>
+
+class QSqlDatabase;
+
+// Versioned schema of the database
+// The schema_version table records the version of the database, and each migration step
+// brings it from one version to the next. Steps are only ever appended, never edited,
+// so that any database, old or new, ends up with the same schema.
+// Each step runs in its own BEGIN IMMEDIATE transaction, and re-checks the version inside it,
+// so that worker processes starting together apply every step exactly once
+class Migrations
+{
+public:
+    static bool run(QSqlDatabase database, int target = -1);   // bring the database up to version target, -1 for the latest
+    static int  getLatestVersion();
+
+private:
+    typedef bool (*Step)(QSqlDatabase& database);
+
+    static int  getVersion(QSqlDatabase& database);
+    static bool exec(QSqlDatabase& database, const QString& sql);
+
+    static bool createTables   (QSqlDatabase& database);   // version 1
+    static bool createIndexes  (QSqlDatabase& database);   // version 2
+    static bool convertTimes   (QSqlDatabase& database);   // version 3
+    static bool createInvalidations(QSqlDatabase& database);   // version 4
+    static bool createProfiles     (QSqlDatabase& database);   // version 5
+    static bool moveHistory        (QSqlDatabase& database);   // version 6
+    static bool groupQuestions     (QSqlDatabase& database);   // version 7
+    static bool decodeKeys         (QSqlDatabase& database);   // version 8
+    static bool logGroupChanges    (QSqlDatabase& database);   // version 9
+
+    static const Step    _steps[];
+    static const char*   _descriptions[];
+};
+
+#endif // MIGRATIONS_H
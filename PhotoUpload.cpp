@@ -0,0 +1,115 @@
+﻿#include "PhotoUpload.h"
+
+#include <qhttprequest.h>
+#include <qhttpresponse.h>
+#include <QDir>
+#include <QRegExp>
+
+static const int SniffSize = 8;   // long enough for all the signatures below
+
+PhotoUpload::PhotoUpload(QHttpRequest* req, QHttpResponse* res, const QString& userName, qint64 maxSize)
+    : QObject(res),   // the upload is over once the response is
+      _response(res),
+      _maxSize(maxSize),
+      _received(0),
+      _failed(false)
+{
+    connect(req, SIGNAL(data(QByteArray)), this, SLOT(onData(QByteArray)));
+    connect(req, SIGNAL(end()),            this, SLOT(onEnd()));
+
+    if(!isValidUserName(userName))
+    {
+        fail(400, tr("Invalid user name %1").arg(userName));
+        return;
+    }
+
+    // reject early if the client announces a photo that's too large
+    if(req->header("content-length").toLongLong() > _maxSize)
+    {
+        fail(413, tr("Photo larger than %1 bytes").arg(_maxSize));
+        return;
+    }
+
+    QDir::current().mkdir("Photos");
+    _file.setFileName("./Photos/" + userName + ".png");
+    if(!_file.open(QIODevice::WriteOnly))
+        fail(500, tr("Unable to save photo"));
+}
+
+/**
+ * A chunk of the body has arrived
+ */
+void PhotoUpload::onData(const QByteArray& data)
+{
+    if(_failed)
+        return;
+
+    _received += data.size();
+    if(_received > _maxSize)
+        return fail(413, tr("Photo larger than %1 bytes").arg(_maxSize));
+
+    if(_header.size() < SniffSize)
+    {
+        _header.append(data.left(SniffSize - _header.size()));
+        if(_header.size() == SniffSize && !isImage(_header))
+            return fail(415, tr("Photos must be PNG, JPEG or GIF"));
+    }
+
+    if(_file.write(data) != data.size())
+        fail(500, tr("Unable to save photo"));
+}
+
+/**
+ * The whole body has arrived, publish the photo
+ */
+void PhotoUpload::onEnd()
+{
+    if(_failed)
+        return;
+
+    if(_header.size() < SniffSize || !isImage(_header))
+        return fail(415, tr("Photos must be PNG, JPEG or GIF"));
+
+    if(!_file.commit())   // renames the temporary file to the photo
+        return fail(500, tr("Unable to save photo"));
+
+    if(_response != 0)
+    {
+        _response->setHeader("Content-Type", "text/html");
+        _response->writeHead(200);
+        _response->end(tr("Photo saved").toUtf8());
+    }
+}
+
+/**
+ * Give up the upload, and tell the client why
+ */
+void PhotoUpload::fail(int statusCode, const QString& message)
+{
+    _failed = true;
+    _file.cancelWriting();   // the old photo, if any, stays
+    if(_response != 0)
+    {
+        _response->setHeader("Content-Type", "text/html");
+        _response->writeHead(statusCode);
+        _response->end(message.toUtf8());
+    }
+}
+
+/**
+ * User names become file names, make sure they stay inside Photos
+ */
+bool PhotoUpload::isValidUserName(const QString& userName) {
+    return !userName.isEmpty() && !userName.contains("..") && !userName.contains(QRegExp("[/\\\\:*?\"<>|]"));
+}
+
+/**
+ * Sniff the type from the first bytes: PNG, JPEG or GIF
+ */
+bool PhotoUpload::isImage(const QByteArray& header)
+{
+    return header.startsWith("\x89PNG\r\n\x1a\n") ||
+           header.startsWith("\xff\xd8\xff")         ||
+           header.startsWith("GIF87a")               ||
+           header.startsWith("GIF89a");
+}
@@ -0,0 +1,40 @@
+﻿#ifndef PHOTOUPLOAD_H
+#define PHOTOUPLOAD_H
+
+#include "qhttpserverfwd.h"
+
+#include <QObject>
+#include <QPointer>
+#include <QSaveFile>
+
+// Receives the photo of a user, chunk by chunk, straight into a file
+// The body is written to a temporary file next to Photos/<user>.png, which replaces
+// the old photo atomically once the whole body has arrived. The name stays .png for the links
+// to it, whatever the type; StaticCache serves it with the type sniffed from its content.
+// Each upload has its own object, so concurrent uploads don't interfere
+class PhotoUpload : public QObject
+{
+    Q_OBJECT
+
+public:
+    PhotoUpload(QHttpRequest* req, QHttpResponse* res, const QString& userName, qint64 maxSize);
+
+private slots:
+    void onData(const QByteArray& data);
+    void onEnd();
+
+private:
+    static bool isValidUserName(const QString& userName);
+    static bool isImage(const QByteArray& header);
+    void fail(int statusCode, const QString& message);
+
+private:
+    QPointer<QHttpResponse> _response;
+    QSaveFile               _file;
+    qint64                  _maxSize;    // max bytes of a photo
+    qint64                  _received;   // bytes received so far
+    QByteArray              _header;     // first bytes of the body, for sniffing its type
+    bool                    _failed;     // the client has been told, ignore the rest of the body
+};
+
+#endif // PHOTOUPLOAD_H
@@ -0,0 +1,67 @@
+﻿#include "QueryString.h"
+
+#include <cstring>
+
+/**
+ * @return  - value of a hex digit, or -1 if it is not one
+ */
+static int hexValue(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * e.g., a%26b -> a&b
+ * @param data      - start of the encoded bytes
+ * @param length    - # of encoded bytes
+ */
+QString QueryString::decode(const char* data, int length)
+{
+    if(memchr(data, '%', length) == 0)   // nothing to decode, the common case
+        return QString::fromUtf8(data, length);
+
+    QByteArray decoded(length, Qt::Uninitialized);   // decoding only shrinks
+    char* out  = decoded.data();
+    int   size = 0;
+    for(int i = 0; i < length; ++i)
+    {
+        int high = i + 2 < length ? hexValue(data[i + 1]) : -1;
+        int low  = i + 2 < length ? hexValue(data[i + 2]) : -1;
+        if(data[i] == '%' && high >= 0 && low >= 0)
+        {
+            out[size++] = static_cast<char>(high * 16 + low);
+            i += 2;
+        }
+        else
+            out[size++] = data[i];
+    }
+    return QString::fromUtf8(decoded.constData(), size);
+}
+
+/**
+ * @param query - the percent-encoded query string
+ */
+QHash<QString, QString> QueryString::parse(const QByteArray& query)
+{
+    QHash<QString, QString> result;
+    const char* data   = query.constData();
+    int         length = query.size();
+    for(int begin = 0; begin < length; )
+    {
+        int end = query.indexOf('&', begin);
+        if(end < 0)
+            end = length;
+        int equal = query.indexOf('=', begin);
+        if(equal < 0 || equal > end)
+            equal = end;
+
+        if(equal > begin)   // skip empty names, e.g., a=1&&b=2
+            result.insert(decode(data + begin, equal - begin),
+                          equal < end ? decode(data + equal + 1, end - equal - 1) : QString());
+        begin = end + 1;
+    }
+    return result;
+}
@@ -0,0 +1,21 @@
+﻿#ifndef QUERYSTRING_H
+#define QUERYSTRING_H
+
+#include <QHash>
+#include <QString>
+#include <QByteArray>
+
+// Parser of a request URL's query string, e.g., action=query&apisig=YYY
+// The encoded bytes are scanned in place, and each name and value is decoded exactly once,
+// so handlers get human readable values, with reserved chars such as & < > # restored
+class QueryString
+{
+public:
+    // name -> value, both percent-decoded
+    static QHash<QString, QString> parse(const QByteArray& query);
+
+    // percent-decode a name or value, '+' is kept as is, the plugin encodes spaces as %20
+    static QString decode(const char* data, int length);
+};
+
+#endif // QUERYSTRING_H
@@ -0,0 +1,371 @@
+﻿#include "QuestionGroups.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QVariant>
+#include <algorithm>
+
+// append value until the vector has size elements
+template <class T>
+static void grow(QVector<T>& vector, int size, const T& value)
+{
+    while(vector.size() < size)
+        vector << value;
+}
+
+QuestionGroups::QuestionGroups()
+    : _loaded(false),
+      _version(-1)
+{}
+
+/**
+ * Parents are followed to their leaders, so a chain of them is one group. A group whose rows
+ * don't name its leader as their parent, e.g., a cycle, or a parent that no longer exists,
+ * is marked dirty, and the rows are fixed with the next change
+ */
+bool QuestionGroups::load(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+    if(!query.exec("select ID, AskCount, Parent from Questions"))
+        return false;
+
+    QMutexLocker locker(&_mutex);
+    _links    .clear();
+    _askCounts.clear();
+    _persisted.clear();
+    _groups   .clear();
+    _dirtyRoots.clear();
+    _deposed   .clear();
+    _touched   .clear();
+    _version  = -1;
+
+    while(query.next())
+    {
+        int id = query.value(0).toInt();
+        if(id < 0)
+            continue;
+        grow(_links,     id + 1, -1);
+        grow(_askCounts, id + 1, 0);
+        grow(_persisted, id + 1, -1);
+        _links    [id] = id;
+        _askCounts[id] = query.value(1).toInt();
+        _persisted[id] = query.value(2).toInt();
+    }
+    _groups.resize(_links.size());
+
+    // groups of one, then each child joins its parent's
+    for(int id = 0; id < _links.size(); ++id)
+        if(contains(id))
+        {
+            _groups[id].leader = -1;
+            _groups[id].members << id;
+            push(_groups[id], id);
+        }
+    for(int id = 0; id < _links.size(); ++id)
+        if(contains(id) && contains(_persisted[id]))
+        {
+            int root      = find(id);
+            int otherRoot = find(_persisted[id]);
+            if(root != otherRoot)
+                unite(root, otherRoot);
+        }
+
+    for(int root = 0; root < _links.size(); ++root)
+        if(contains(root) && _links[root] == root)
+            elect(root);
+
+    _loaded = true;
+    return true;
+}
+
+/**
+ * Groups only ever merge, so a changed row is a new question, a new ask count, or a Parent
+ * joining two groups. The groups of the changed rows elect their leaders again, as load() does
+ */
+bool QuestionGroups::update(QSqlDatabase database, qint64 afterChange)
+{
+    QSqlQuery query(database);
+    query.prepare("select ID, AskCount, Parent from Questions \
+                   where ID in (select QuestionID from GroupChanges where ID > :after)");
+    query.bindValue(":after", afterChange);
+    if(!query.exec())
+        return false;
+
+    QMutexLocker locker(&_mutex);
+    QList<int> changed;
+    while(query.next())
+    {
+        int id       = query.value(0).toInt();
+        int askCount = query.value(1).toInt();
+        if(id < 0)
+            continue;
+        if(!contains(id))   // a group of its own, for now
+        {
+            grow(_links,     id + 1, -1);
+            grow(_askCounts, id + 1, 0);
+            grow(_persisted, id + 1, -1);
+            _groups.resize(_links.size());
+            _links    [id] = id;
+            _askCounts[id] = askCount;
+            _groups   [id] = Group();
+            _groups   [id].members << id;
+            push(_groups[id], id);
+        }
+        else if(_askCounts[id] != askCount)
+        {
+            _askCounts[id] = askCount;
+            push(_groups[find(id)], id);   // the old entry is stale now
+        }
+        _persisted[id] = query.value(2).toInt();
+        changed << id;
+    }
+
+    foreach(int id, changed)
+        if(contains(_persisted[id]))
+        {
+            int root      = find(id);
+            int otherRoot = find(_persisted[id]);
+            if(root != otherRoot)
+                unite(root, otherRoot);
+        }
+
+    QSet<int> roots;
+    foreach(int id, changed)
+        roots << find(id);
+    foreach(int root, roots)
+    {
+        _groups[root].leader = -1;
+        elect(root);
+    }
+    return true;
+}
+
+bool QuestionGroups::isLoaded() const
+{
+    QMutexLocker locker(&_mutex);
+    return _loaded;
+}
+
+qint64 QuestionGroups::getVersion() const
+{
+    QMutexLocker locker(&_mutex);
+    return _version;
+}
+
+void QuestionGroups::setVersion(qint64 version)
+{
+    QMutexLocker locker(&_mutex);
+    _version = version;
+}
+
+/**
+ * The row was inserted with Parent -1, nothing to write
+ */
+void QuestionGroups::add(int questionID, int askCount)
+{
+    QMutexLocker locker(&_mutex);
+    if(questionID < 0 || contains(questionID))
+        return;
+
+    grow(_links,     questionID + 1, -1);
+    grow(_askCounts, questionID + 1, 0);
+    grow(_persisted, questionID + 1, -1);
+    _groups.resize(_links.size());
+
+    _links    [questionID] = questionID;
+    _askCounts[questionID] = askCount;
+    _persisted[questionID] = -1;
+    Group& group = _groups[questionID];
+    group.leader = questionID;
+    group.members.clear();
+    group.heap   .clear();
+    group.members << questionID;
+    push(group, questionID);
+    _touched << questionID;
+}
+
+/**
+ * The question takes over its group if it is now the most asked, ties keep the leader
+ */
+void QuestionGroups::ask(int questionID)
+{
+    QMutexLocker locker(&_mutex);
+    if(!contains(questionID))
+        return;
+
+    ++ _askCounts[questionID];
+    _touched << questionID;
+
+    int root = find(questionID);
+    Group& group = _groups[root];
+    push(group, questionID);   // the old entry is stale now
+
+    // stale entries pile up in a group that is asked a lot
+    if(group.heap.size() > 2 * group.members.size() + 16)
+    {
+        group.heap.clear();
+        foreach(int member, group.members)
+            group.heap << Entry(_askCounts[member], member);
+        std::make_heap(group.heap.begin(), group.heap.end());
+    }
+
+    int candidate = top(group);
+    if(candidate != group.leader && _askCounts[candidate] > _askCounts[group.leader])
+        setLeader(root, candidate);
+}
+
+/**
+ * The lead's leader leads both groups, until a member is asked more
+ * @return  - false if either question is unknown, or they are already in one group
+ */
+bool QuestionGroups::merge(int leadID, int questionID)
+{
+    QMutexLocker locker(&_mutex);
+    if(!contains(leadID) || !contains(questionID))
+        return false;
+
+    int leadRoot     = find(leadID);
+    int questionRoot = find(questionID);
+    if(leadRoot == questionRoot)
+        return false;
+
+    int leader  = _groups[leadRoot]    .leader;
+    int deposed = _groups[questionRoot].leader;
+    int root = unite(leadRoot, questionRoot);
+    _groups[root].leader = leader;
+    _deposed << deposed;
+    _dirtyRoots << root;
+    return true;
+}
+
+int QuestionGroups::getLeader(int questionID)
+{
+    QMutexLocker locker(&_mutex);
+    return contains(questionID) ? _groups[find(questionID)].leader : -1;
+}
+
+/**
+ * Only the members whose Parent differs from the database are returned, and are then taken
+ * as persisted. If writing them fails, the caller reloads the groups
+ */
+QuestionGroups::Changes QuestionGroups::takeChanges()
+{
+    QMutexLocker locker(&_mutex);
+    Changes changes;
+    foreach(int root, _dirtyRoots)
+    {
+        if(_links[root] != root)   // merged into another dirty group
+            continue;
+        const Group& group = _groups[root];
+        foreach(int member, group.members)
+        {
+            int parent = member == group.leader ? -1 : group.leader;
+            if(_persisted[member] != parent)
+            {
+                changes.parents.insert(member, parent);
+                changes.questions << member;
+                _persisted[member] = parent;
+            }
+        }
+    }
+    changes.deposed    = _deposed;
+    changes.questions += _touched;
+    _dirtyRoots.clear();
+    _deposed   .clear();
+    _touched   .clear();
+    return changes;
+}
+
+bool QuestionGroups::contains(int questionID) const {
+    return questionID >= 0 && questionID < _links.size() && _links[questionID] >= 0;
+}
+
+/**
+ * Path compression: every question on the way points to the root afterwards
+ */
+int QuestionGroups::find(int questionID)
+{
+    int root = questionID;
+    while(_links[root] != root)
+        root = _links[root];
+    while(_links[questionID] != root)
+    {
+        int next = _links[questionID];
+        _links[questionID] = root;
+        questionID = next;
+    }
+    return root;
+}
+
+/**
+ * Union by size: the smaller group moves into the larger one, with its valid heap entries
+ * The caller sets the leader
+ */
+int QuestionGroups::unite(int root, int otherRoot)
+{
+    if(_groups[root].members.size() < _groups[otherRoot].members.size())
+        qSwap(root, otherRoot);
+
+    Group& larger  = _groups[root];
+    Group& smaller = _groups[otherRoot];
+    _links[otherRoot] = root;
+    larger.members += smaller.members;
+    foreach(const Entry& entry, smaller.heap)
+        if(entry.askCount == _askCounts[entry.questionID])
+        {
+            larger.heap << entry;
+            std::push_heap(larger.heap.begin(), larger.heap.end());
+        }
+    smaller = Group();
+    return root;
+}
+
+/**
+ * Drops the stale entries on the top
+ */
+int QuestionGroups::top(Group& group)
+{
+    while(!group.heap.isEmpty())
+    {
+        const Entry& entry = group.heap.first();
+        if(entry.askCount == _askCounts[entry.questionID])
+            return entry.questionID;
+        std::pop_heap(group.heap.begin(), group.heap.end());
+        group.heap.removeLast();
+    }
+    return group.leader;
+}
+
+void QuestionGroups::push(Group& group, int questionID)
+{
+    group.heap << Entry(_askCounts[questionID], questionID);
+    std::push_heap(group.heap.begin(), group.heap.end());
+}
+
+void QuestionGroups::setLeader(int root, int leader)
+{
+    Group& group = _groups[root];
+    if(group.leader >= 0 && group.leader != leader)
+        _deposed << group.leader;
+    group.leader = leader;
+    _dirtyRoots << root;
+}
+
+/**
+ * The leader is the one without a parent, or the most asked if there's none
+ * A group whose rows don't all name the leader is marked dirty
+ */
+void QuestionGroups::elect(int root)
+{
+    Group& group = _groups[root];
+    foreach(int member, group.members)
+        if(_persisted[member] == -1 &&
+           (group.leader < 0 || Entry(_askCounts[group.leader], group.leader) < Entry(_askCounts[member], member)))
+            group.leader = member;
+    if(group.leader < 0)
+        group.leader = top(group);
+
+    foreach(int member, group.members)
+        if(_persisted[member] != (member == group.leader ? -1 : group.leader))
+            _dirtyRoots << root;
+}
@@ -0,0 +1,92 @@
+﻿#ifndef QUESTIONGROUPS_H
+#define QUESTIONGROUPS_H
+
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QMutex>
+
+class QSqlDatabase;
+
+// Groups of similar-meaning questions, in memory, each led by its most asked question
+// A disjoint set over question IDs: union by size and path compression make finding a
+// question's group and merging two groups near-constant time. Each group keeps a max-heap of
+// its members' ask counts, so a new leader is found without scanning the group. An entry goes
+// stale when its question is asked again, and is dropped once it reaches the top.
+// The Parent column of Questions is the persisted form: a member's Parent is its leader, the
+// leader's is -1. The groups record which rows no longer match it, for DAO to write in the
+// transaction of the change, and which rows changed at all, for DAO to log in GroupChanges.
+// Other processes re-read just the logged rows.
+// Thread safe
+class QuestionGroups
+{
+public:
+    // what changed since the last takeChanges()
+    struct Changes
+    {
+        QHash<int, int> parents;   // question ID -> its new Parent
+        QList<int>      deposed;   // leaders who lost their groups
+        QSet<int>       questions; // whose rows changed at all: new, asked again, or with a new Parent
+    };
+
+    QuestionGroups();
+
+    bool load(QSqlDatabase database);   // from Questions, drops the pending changes
+    bool isLoaded() const;
+
+    // re-read the questions logged in GroupChanges after a change, e.g., by other processes
+    bool update(QSqlDatabase database, qint64 afterChange);
+
+    // the last change in GroupChanges the groups reflect, -1 if unknown
+    qint64 getVersion() const;
+    void   setVersion(qint64 version);
+
+    void add  (int questionID, int askCount = 1);   // a new question, leading a group of its own
+    void ask  (int questionID);                      // asked once more, it may take over its group
+    bool merge(int leadID, int questionID);          // the question's group joins the lead's, keeping its leader
+
+    int getLeader(int questionID);   // -1 if unknown
+    Changes takeChanges();
+
+private:
+    struct Entry
+    {
+        Entry(int count = 0, int id = -1) : askCount(count), questionID(id) {}
+        int askCount;
+        int questionID;
+        bool operator<(const Entry& other) const {   // fewer asks, or a higher ID on a tie
+            return askCount < other.askCount ||
+                  (askCount == other.askCount && questionID > other.questionID);
+        }
+    };
+    struct Group   // valid at the roots only
+    {
+        Group() : leader(-1) {}
+        int            leader;
+        QVector<int>   members;
+        QVector<Entry> heap;
+    };
+
+    bool contains(int questionID) const;   // locked
+    int  find    (int questionID);
+    int  unite   (int root, int otherRoot);   // returns the root of both
+    int  top     (Group& group);           // the most asked member
+    void push    (Group& group, int questionID);
+    void setLeader(int root, int leader);
+    void elect   (int root);           // the leader of a group read from the database
+
+private:
+    mutable QMutex _mutex;
+    QVector<int>   _links;        // question ID -> next toward the root, -1 for no such question
+    QVector<int>   _askCounts;
+    QVector<int>   _persisted;    // question ID -> Parent in the database
+    QVector<Group> _groups;       // root ID -> its group
+    QSet<int>      _dirtyRoots;   // groups that may not match the database
+    QList<int>     _deposed;
+    QSet<int>      _touched;      // questions whose rows changed, besides Parent
+    bool           _loaded;
+    qint64         _version;
+};
+
+#endif // QUESTIONGROUPS_H
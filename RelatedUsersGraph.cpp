@@ -0,0 +1,176 @@
+﻿#include "RelatedUsersGraph.h"
+
+#include <QSaveFile>
+#include <QFile>
+#include <QDataStream>
+#include <algorithm>
+
+static const quint32 SnapshotMagic   = 0x46524731;   // "FRG1"
+static const int     MinCompactSize  = 4096;          // delta edges before the rows are rebuilt
+
+RelatedUsersGraph::RelatedUsersGraph()
+    : _deltaSize(0),
+      _watermark(0)
+{
+    _offsets << 0;
+}
+
+void RelatedUsersGraph::addEdge(int userID, int otherID, int weight)
+{
+    if(userID < 0 || otherID < 0 || userID == otherID)
+        return;
+
+    QWriteLocker locker(&_lock);
+    addHalfEdge(userID,  otherID, weight);
+    addHalfEdge(otherID, userID,  weight);
+
+    // rebuilding costs as much as the rows, so do it when the delta is a fraction of them
+    if(_deltaSize > qMax(MinCompactSize, _neighbors.size() / 8))
+        compact();
+}
+
+void RelatedUsersGraph::addHalfEdge(int userID, int otherID, int weight)
+{
+    QHash<int, int>& row = _delta[userID];
+    if(!row.contains(otherID))
+        ++ _deltaSize;
+    row[otherID] += weight;
+}
+
+/**
+ * @return  - the edges of a user, sorted by neighbor ID
+ */
+QVector<RelatedUsersGraph::Edge> RelatedUsersGraph::getRow(int userID) const
+{
+    QVector<Edge> result;
+    if(userID + 1 < _offsets.size())
+        for(int i = _offsets[userID]; i < _offsets[userID + 1]; ++i)
+            result << Edge(_neighbors[i], _weights[i]);
+
+    QHash<int, QHash<int, int> >::const_iterator delta = _delta.find(userID);
+    if(delta == _delta.end())
+        return result;
+
+    int compacted = result.size();
+    for(QHash<int, int>::const_iterator it = delta->begin(); it != delta->end(); ++it)
+    {
+        QVector<Edge>::iterator found = std::lower_bound(result.begin(), result.begin() + compacted,
+                                                         Edge(it.key(), 0));
+        if(found != result.begin() + compacted && found->first == it.key())
+            found->second += it.value();
+        else
+            result << Edge(it.key(), it.value());
+    }
+    if(result.size() > compacted)   // new neighbors
+        std::sort(result.begin(), result.end());
+    return result;
+}
+
+static bool heavierThan(const RelatedUsersGraph::Edge& lhs, const RelatedUsersGraph::Edge& rhs) {
+    return lhs.second != rhs.second ? lhs.second > rhs.second : lhs.first < rhs.first;
+}
+
+QVector<RelatedUsersGraph::Edge> RelatedUsersGraph::getTopRelated(int userID, int k) const
+{
+    QReadLocker locker(&_lock);
+    QVector<Edge> row = getRow(userID);
+    locker.unlock();
+
+    k = qBound(0, k, row.size());
+    std::partial_sort(row.begin(), row.begin() + k, row.end(), heavierThan);
+    row.resize(k);
+    return row;
+}
+
+void RelatedUsersGraph::compact()
+{
+    int userCount = _offsets.size() - 1;
+    foreach(int userID, _delta.keys())
+        userCount = qMax(userCount, userID + 1);
+
+    QVector<int> offsets;
+    QVector<int> neighbors;
+    QVector<int> weights;
+    offsets.reserve(userCount + 1);
+    neighbors.reserve(_neighbors.size() + _deltaSize);
+    weights  .reserve(_neighbors.size() + _deltaSize);
+    for(int userID = 0; userID < userCount; ++userID)
+    {
+        offsets << neighbors.size();
+        foreach(const Edge& edge, getRow(userID))
+        {
+            neighbors << edge.first;
+            weights   << edge.second;
+        }
+    }
+    offsets << neighbors.size();
+
+    _offsets   = offsets;
+    _neighbors = neighbors;
+    _weights   = weights;
+    _delta.clear();
+    _deltaSize = 0;
+}
+
+qint64 RelatedUsersGraph::getWatermark() const
+{
+    QReadLocker locker(&_lock);
+    return _watermark;
+}
+
+void RelatedUsersGraph::setWatermark(qint64 watermark)
+{
+    QWriteLocker locker(&_lock);
+    _watermark = watermark;
+}
+
+bool RelatedUsersGraph::load(const QString& filePath)
+{
+    QFile file(filePath);
+    if(!file.open(QFile::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic;
+    qint64  watermark;
+    QVector<int> offsets, neighbors, weights;
+    in >> magic >> watermark >> offsets >> neighbors >> weights;
+    if(in.status() != QDataStream::Ok || magic != SnapshotMagic || offsets.isEmpty() ||
+       offsets.last() != neighbors.size() || neighbors.size() != weights.size())
+        return false;
+
+    QWriteLocker locker(&_lock);
+    _offsets   = offsets;
+    _neighbors = neighbors;
+    _weights   = weights;
+    _watermark = watermark;
+    _delta.clear();
+    _deltaSize = 0;
+    return true;
+}
+
+/**
+ * Write a snapshot, atomically: a reader sees the old or the new one, never a partial one
+ */
+bool RelatedUsersGraph::save(const QString& filePath)
+{
+    QSaveFile file(filePath);
+    if(!file.open(QFile::WriteOnly))
+        return false;
+
+    // the vectors are implicitly shared, so the copies are cheap, and written without the lock
+    QVector<int> offsets, neighbors, weights;
+    qint64 watermark;
+    {
+        QWriteLocker locker(&_lock);
+        compact();
+        offsets   = _offsets;
+        neighbors = _neighbors;
+        weights   = _weights;
+        watermark = _watermark;
+    }
+
+    QDataStream out(&file);
+    out << SnapshotMagic << watermark << offsets << neighbors << weights;
+    return file.commit();
+}
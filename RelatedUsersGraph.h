@@ -0,0 +1,51 @@
+﻿#ifndef RELATEDUSERSGRAPH_H
+#define RELATEDUSERSGRAPH_H
+
+#include <QVector>
+#include <QHash>
+#include <QPair>
+#include <QReadWriteLock>
+
+// In-memory user-user co-occurrence graph: two users are related by the # of questions
+// both of them asked or viewed
+// The edges are kept in compressed sparse rows, indexed by user ID, each row sorted by
+// neighbor ID. New weights go to a small delta first, which is merged into the rows once it
+// has grown, so that adding an edge doesn't rebuild the rows.
+// The graph is saved to a snapshot, with the watermark of the events it reflects, so that
+// a restart only replays the events after it.
+// Thread safe
+class RelatedUsersGraph
+{
+public:
+    typedef QPair<int, int> Edge;   // neighbor ID -> weight
+
+    RelatedUsersGraph();
+
+    void addEdge(int userID, int otherID, int weight = 1);   // both ways
+
+    // the k users most related to userID, heaviest first, ties by ID
+    QVector<Edge> getTopRelated(int userID, int k) const;
+
+    // ID of the last event the graph reflects
+    qint64 getWatermark() const;
+    void   setWatermark(qint64 watermark);
+
+    bool load(const QString& filePath);   // false if there's no valid snapshot
+    bool save(const QString& filePath);
+
+private:
+    void addHalfEdge(int userID, int otherID, int weight);   // locked
+    QVector<Edge> getRow(int userID) const;                  // CSR row and delta merged, by neighbor ID
+    void compact();                                          // merge the delta into the rows, locked
+
+private:
+    mutable QReadWriteLock   _lock;
+    QVector<int>             _offsets;     // user ID -> start of its row in _neighbors, one extra at the end
+    QVector<int>             _neighbors;
+    QVector<int>             _weights;     // of each neighbor
+    QHash<int, QHash<int, int> > _delta;   // user ID -> neighbor ID -> weight added since compact()
+    int                      _deltaSize;   // # of edges in _delta
+    qint64                   _watermark;
+};
+
+#endif // RELATEDUSERSGRAPH_H
@@ -0,0 +1,26 @@
+﻿#ifndef REPLY_H
+#define REPLY_H
+
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+
+// The result of a request handler
+// Handlers run on worker threads and must not touch QHttpResponse, which belongs to
+// the connection's thread, so they fill in a Reply and Server writes it back
+struct Reply
+{
+    Reply(int code = 200, const QByteArray& content = QByteArray(),
+          const QString& contentType = "text/html")
+        : statusCode(code), body(content)
+    {
+        if(!contentType.isEmpty())
+            headers.insert("Content-Type", contentType);
+    }
+
+    int                     statusCode;
+    QMap<QString, QString>  headers;     // header name -> value
+    QByteArray              body;
+};
+
+#endif // REPLY_H
@@ -0,0 +1,49 @@
+﻿#include "RequestTask.h"
+#include "Compressor.h"
+#include "Settings.h"
+#include "Tracer.h"
+
+#include <qhttpresponse.h>
+
+RequestTask::RequestTask(Server* server, const QString& action, Server::Handler handler,
+                         const Server::Parameters& params, const QString& acceptEncoding, QHttpResponse* res)
+    : _server(server),
+      _action(action),
+      _handler(handler),
+      _params(params),
+      _acceptEncoding(acceptEncoding),
+      _response(res),
+      _traced(false)
+{
+    setAutoDelete(false);   // Server deletes the task after the reply is written
+    _timer.start();
+}
+
+/**
+ * Execute the handler on the current (worker) thread
+ * The reply is compressed here too, to keep the CPU work off the I/O thread
+ * A traced request gets the name of its trace file in the X-Trace header
+ */
+void RequestTask::run()
+{
+    Tracer* tracer = Tracer::getInstance();
+    if(_traced)
+    {
+        tracer->begin(_action);
+        qint64 waited = getElapsed();   // since the request arrived
+        tracer->addSpan("queued", tracer->now() - waited, waited);
+    }
+
+    {
+        TRACE_SPAN("handler");
+        _reply = (_server->*_handler)(_params, _body);
+    }
+    {
+        TRACE_SPAN("compress");
+        Compressor::compress(_reply, _acceptEncoding, Settings::getInstance()->getCompressionThreshold());
+    }
+
+    if(_traced)
+        _reply.headers.insert("X-Trace", tracer->end());
+    emit finished();
+}
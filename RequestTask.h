@@ -0,0 +1,49 @@
+﻿#ifndef REQUESTTASK_H
+#define REQUESTTASK_H
+
+#include "Server.h"
+#include "Reply.h"
+
+#include <QObject>
+#include <QRunnable>
+#include <QPointer>
+#include <QElapsedTimer>
+
+// Runs one request handler on a worker thread of Server's thread pool
+// finished() is emitted from the worker thread, and delivered to Server on the
+// connection's thread, where the reply is written to the response
+class RequestTask : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    RequestTask(Server* server, const QString& action, Server::Handler handler,
+                const Server::Parameters& params, const QString& acceptEncoding, QHttpResponse* res);
+    void run();
+
+    void appendBody(const QByteArray& data) { _body.append(data); }
+    int  getBodySize() const { return _body.size(); }
+    void setTraced(bool traced) { _traced = traced; }
+
+    QString        getAction()   const { return _action;   }
+    QHttpResponse* getResponse() const { return _response; }
+    const Reply&   getReply()    const { return _reply;    }
+    qint64         getElapsed()  const { return _timer.nsecsElapsed() / 1000; }   // us since the request arrived
+
+signals:
+    void finished();
+
+private:
+    Server*                 _server;
+    QString                 _action;
+    Server::Handler         _handler;
+    Server::Parameters      _params;
+    QByteArray              _body;             // of a POST request
+    QString                 _acceptEncoding;   // of the request, for compressing the reply
+    QPointer<QHttpResponse> _response;   // the client may disconnect before the reply is ready
+    Reply                   _reply;
+    QElapsedTimer           _timer;      // started when the request arrives
+    bool                    _traced;     // record a trace of the handler
+};
+
+#endif // REQUESTTASK_H
@@ -0,0 +1,190 @@
+﻿#include "ResponseCache.h"
+#include "SignatureIndex.h"
+#include "DAO.h"
+#include "Metrics.h"
+
+#include <QMap>
+
+static const int MaxRecent = 1024;
+
+// rough per entry bookkeeping: the entry, its hash node and the byte array's header
+static const qint64 EntryOverhead = sizeof(void*) * 16;
+
+ResponseCache::ResponseCache(qint64 capacity)
+    : _head(0),
+      _tail(0),
+      _capacity(qMax<qint64>(capacity, 0)),
+      _size(0),
+      _sketch(static_cast<int>(qMin<qint64>(_capacity / 4096, 1 << 20))),   // replies are a few KB
+      _generation(_capacity > 0 ? DAO::getInstance()->getLastInvalidation() : 0)
+{}
+
+ResponseCache::~ResponseCache() {
+    clear();
+}
+
+/**
+ * Get the reply to a query for a class, from the cache if possible
+ * @param classSig      - the class
+ * @param reply         - output, the cached reply
+ * @param generation    - output, the invalidations the reply would reflect, for insert()
+ * @return              - false on a miss
+ */
+bool ResponseCache::lookup(const QString& classSig, Reply& reply, int& generation)
+{
+    static const int hits   = Metrics::getInstance()->getCounter("faqs_response_cache_hits_total");
+    static const int misses = Metrics::getInstance()->getCounter("faqs_response_cache_misses_total");
+
+    if(_capacity == 0)
+        return false;
+
+    refresh();
+
+    QString key = SignatureIndex::fold(classSig);
+    QMutexLocker locker(&_mutex);
+    _sketch.increment(key);
+    generation = _generation;
+
+    Entry* entry = _entries.value(key);
+    if(entry == 0)
+    {
+        Metrics::getInstance()->add(misses);
+        return false;
+    }
+
+    Metrics::getInstance()->add(hits);
+    unlink(entry);
+    pushFront(entry);
+    reply = Reply(entry->statusCode, entry->body);
+    return true;
+}
+
+void ResponseCache::insert(const QString& classSig, const Reply& reply, int generation)
+{
+    static const int rejections = Metrics::getInstance()->getCounter("faqs_response_cache_rejections_total");
+    static const int evictions  = Metrics::getInstance()->getCounter("faqs_response_cache_evictions_total");
+
+    if(_capacity == 0)
+        return;
+
+    QString key = SignatureIndex::fold(classSig);
+    qint64 cost = reply.body.size() + key.size() * sizeof(QChar) + EntryOverhead;
+    if(cost > _capacity)
+        return;
+
+    QMutexLocker locker(&_mutex);
+
+    // the reply may have been read before a write that has been applied since
+    if(generation < _generation)
+    {
+        if(_recent.isEmpty() || _recent.first().first > generation + 1)   // too far behind to tell
+            return;
+        for(int i = _recent.size() - 1; i >= 0 && _recent[i].first > generation; --i)
+            if(_recent[i].second.startsWith(key))
+                return;
+    }
+
+    if(Entry* existing = _entries.value(key))   // inserted by a concurrent miss
+        remove(existing);
+
+    // TinyLFU: evict only the victims less popular than the newcomer
+    int frequency = _sketch.estimate(key);
+    while(_size + cost > _capacity)
+    {
+        if(_sketch.estimate(_tail->key) >= frequency)
+        {
+            Metrics::getInstance()->add(rejections);
+            return;
+        }
+        remove(_tail);
+        Metrics::getInstance()->add(evictions);
+    }
+
+    Entry* entry = new Entry;
+    entry->key        = key;
+    entry->statusCode = reply.statusCode;
+    entry->body       = reply.body;
+    entry->cost       = cost;
+    _entries.insert(key, entry);
+    pushFront(entry);
+    _size += cost;
+}
+
+/**
+ * Apply the invalidations logged since the last refresh, by this process or others
+ */
+void ResponseCache::refresh()
+{
+    int generation;
+    {
+        QMutexLocker locker(&_mutex);
+        generation = _generation;
+    }
+    QMap<int, QString> invalidations = DAO::getInstance()->getInvalidations(generation);
+    if(invalidations.isEmpty())
+        return;
+
+    QMutexLocker locker(&_mutex);
+    for(QMap<int, QString>::const_iterator it = invalidations.constBegin(); it != invalidations.constEnd(); ++it)
+    {
+        if(it.key() <= _generation)   // applied by a concurrent refresh
+            continue;
+        if(it.key() > _generation + 1)   // missed some, they have been pruned
+        {
+            clear();
+            _recent.clear();
+        }
+
+        QString signature = SignatureIndex::fold(it.value());
+        invalidate(signature);
+        _generation = it.key();
+        _recent << qMakePair(_generation, signature);
+        if(_recent.size() > MaxRecent)
+            _recent.removeFirst();
+    }
+}
+
+/**
+ * Drop the replies of the classes a signature starts with, i.e., those that list the API
+ * @param signature - folded API signature
+ */
+void ResponseCache::invalidate(const QString& signature)
+{
+    static const int invalidations = Metrics::getInstance()->getCounter("faqs_response_cache_invalidations_total");
+    for(int length = 0; length <= signature.length(); ++length)
+        if(Entry* entry = _entries.value(signature.left(length)))
+        {
+            remove(entry);
+            Metrics::getInstance()->add(invalidations);
+        }
+}
+
+void ResponseCache::remove(Entry* entry)
+{
+    unlink(entry);
+    _entries.remove(entry->key);
+    _size -= entry->cost;
+    delete entry;
+}
+
+void ResponseCache::unlink(Entry* entry)
+{
+    (entry->prev != 0 ? entry->prev->next : _head) = entry->next;
+    (entry->next != 0 ? entry->next->prev : _tail) = entry->prev;
+}
+
+void ResponseCache::pushFront(Entry* entry)
+{
+    entry->prev = 0;
+    entry->next = _head;
+    (_head != 0 ? _head->prev : _tail) = entry;
+    _head = entry;
+}
+
+void ResponseCache::clear()
+{
+    qDeleteAll(_entries);
+    _entries.clear();
+    _head = _tail = 0;
+    _size = 0;
+}
@@ -0,0 +1,63 @@
+﻿#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include "FrequencySketch.h"
+#include "Reply.h"
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QMutex>
+
+// An in-memory cache of the rendered FAQs of classes, i.e., the replies to action=query,
+// keyed by class signature, case insensitive as the query is
+// The total size is bounded, least recently used replies are evicted first, but only if
+// the new reply is more popular than them (TinyLFU), so a scan of rarely asked classes
+// can't flush the popular ones.
+// DAO logs the APIs each write touches, in any process, see DAO::getInvalidations.
+// A lookup applies the new ones first, dropping the replies of the classes that are prefixes
+// of the APIs, so it never returns FAQs older than the database.
+// Thread safe
+class ResponseCache
+{
+public:
+    ResponseCache(qint64 capacity);   // in bytes, 0 for no caching
+    ~ResponseCache();
+
+    // generation is output, to pass to insert() on a miss
+    bool lookup(const QString& classSig, Reply& reply, int& generation);
+
+    // a reply computed after lookup() returned generation, dropped if the class changed since
+    void insert(const QString& classSig, const Reply& reply, int generation);
+
+private:
+    struct Entry
+    {
+        QString    key;
+        int        statusCode;
+        QByteArray body;
+        qint64     cost;
+        Entry*     prev;   // more recently used
+        Entry*     next;   // less recently used
+    };
+
+    void refresh();                                  // apply new invalidations
+    void invalidate(const QString& signature);       // drop the prefixes of signature
+    void remove   (Entry* entry);
+    void unlink   (Entry* entry);
+    void pushFront(Entry* entry);
+    void clear();
+
+private:
+    QMutex                 _mutex;
+    QHash<QString, Entry*> _entries;      // folded class signature -> reply
+    Entry*                 _head;         // most recently used
+    Entry*                 _tail;         // least recently used, the next victim
+    qint64                 _capacity;
+    qint64                 _size;
+    FrequencySketch        _sketch;
+    int                    _generation;   // ID of the last invalidation applied
+    QList<QPair<int, QString> > _recent;  // last invalidations applied, ID -> folded signature
+};
+
+#endif // RESPONSECACHE_H
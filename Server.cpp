@@ -2,30 +2,301 @@
 #include "DAO.h"
 #include "SnippetCreator.h"
 #include "Settings.h"
+#include "RequestTask.h"
+#include "WriteBehindQueue.h"
+#include "StaticCache.h"
+#include "ResponseCache.h"
+#include "EventLog.h"
+#include "FileSender.h"
+#include "Compressor.h"
+#include "PhotoUpload.h"
+#include "AdmissionController.h"
+#include "Metrics.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "WriteForwarder.h"
+#include "WriteReceiver.h"
+#include "QueryString.h"
 
 #include <QStringList>
 #include <QJsonDocument>
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QUrl>
-#include <QDebug>
 
 #include <qhttpserver.h>
 #include <qhttprequest.h>
 #include <qhttpresponse.h>
 #include <QFile>
 #include <QDir>
+#include <QThreadPool>
+#include <QLocale>
+#include <QFileInfo>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QElapsedTimer>
+#include <QTcpServer>
+#include <QTimer>
+#include <QCoreApplication>
+#include <QRunnable>
 
-Server::Server()
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Reply for a request that was not accepted, because the server is saturated
+ */
+static Reply createBusyReply()
+{
+    Reply reply(503, QObject::tr("Server busy, try again later").toUtf8());
+    reply.headers.insert("Retry-After", "1");
+    return reply;
+}
+
+Server::Server(int worker, int generation)
+    : _worker(worker),
+      _openResponses(0),
+      _shuttingDown(false),
+      _writeForwarder(0),
+      _writeReceiver(0)
 {
-    QHttpServer* server = new QHttpServer(this);
-    connect(server, SIGNAL(newRequest(QHttpRequest*, QHttpResponse*)),
-            this,   SLOT  (onRequest (QHttpRequest*, QHttpResponse*)));
+    _httpServer = new QHttpServer(this);
+    connect(_httpServer, SIGNAL(newRequest(QHttpRequest*, QHttpResponse*)),
+            this,        SLOT  (onRequest (QHttpRequest*, QHttpResponse*)));
             
     Settings* settings = Settings::getInstance();
-    server->listen(settings->getServerPort());
 
-    qDebug() << "FAQsServer running on port" << settings->getServerPort();
+    // DAO receives similarity results through the event loop, so it must live on this thread
+    DAO::getInstance();
+
+    _pool = new QThreadPool(this);
+    _pool->setMaxThreadCount(settings->getWorkerThreads());
+    _pool->setExpiryTimeout(-1);   // keep the threads, and their database connections, alive
+    _admission = new AdmissionController(_pool);
+
+    _writeBehind = settings->getDurability() != "immediate";
+    if(_writeBehind)
+        WriteBehindQueue::getInstance();   // start the writer
+
+    // under Supervisor, batched writes go to worker 0 of the generation
+    // the others keep their own queue for when the writer can't be reached
+    QString writerName = tr("FAQsServer-%1-%2").arg(settings->getServerPort()).arg(generation);
+    if(_writeBehind && _worker == 0)
+        _writeReceiver = new WriteReceiver(writerName, this);
+    else if(_writeBehind && _worker > 0)
+        _writeForwarder = new WriteForwarder(writerName, settings->getWriteQueueCapacity(), this);
+
+    _staticCache = new StaticCache(settings->getStaticCacheSize(), this);
+    _responseCache = new ResponseCache(settings->getResponseCacheSize());
+
+    // every process buffers its own events, a quiet one must not keep them
+    if(settings->getEventFlushInterval() > 0)
+    {
+        QTimer* flushTimer = new QTimer(this);
+        connect(flushTimer, SIGNAL(timeout()), DAO::getInstance(), SLOT(flushHistory()));
+        flushTimer->start(settings->getEventFlushInterval());
+    }
+
+    // one process snapshots the in-memory indexes, they are the same in all
+    if(_worker <= 0)
+    {
+        QTimer* snapshotTimer = new QTimer(this);
+        connect(snapshotTimer, SIGNAL(timeout()), DAO::getInstance(), SLOT(saveSnapshots()));
+        connect(snapshotTimer, SIGNAL(timeout()), DAO::getInstance(), SLOT(compactHistory()));
+        snapshotTimer->start(settings->getSnapshotInterval() * 1000);
+
+        if(settings->getGraphCheckInterval() > 0)
+        {
+            QTimer* checkTimer = new QTimer(this);
+            connect(checkTimer, SIGNAL(timeout()), this, SLOT(onCheckGraph()));
+            checkTimer->start(settings->getGraphCheckInterval() * 1000);
+        }
+    }
+
+    registerHandler("ping",      &Server::processPingRequest);
+    registerHandler("save",      &Server::processSaveRequest);
+    registerHandler("logapi",    &Server::processLogDocumentReadingRequest);
+    registerHandler("loganswer", &Server::processLogAnswerClickingRequest);
+    registerHandler("query",     &Server::processQueryRequest);
+    registerHandler("personal",  &Server::processQueryUserProfileRequest);
+    registerHandler("batch",     &Server::processBatchRequest);
+    registerHandler("metrics",   &Server::processMetricsRequest);
+
+    if(!listen(settings->getServerPort()))
+        LOG_ERROR("server", tr("can not listen port=%1").arg(settings->getServerPort()));
+
+    LOG_INFO("server", tr("listening port=%1 process=%2 workers=%3 durability=%4")
+                       .arg(settings->getServerPort())
+                       .arg(_worker)
+                       .arg(settings->getWorkerThreads())
+                       .arg(settings->getDurability()));
+}
+
+Server::~Server()
+{
+    // finish running handlers, then make sure everything they queued hits the disk
+    _pool->waitForDone();
+    foreach(RequestTask* task, _admission->takeWaiting())   // queued after shutdown(), on open connections
+        reject(task);
+    delete _admission;
+    if(_writeForwarder)
+        _writeForwarder->drain(5000);   // what the last handlers forwarded
+    if(_writeBehind)
+        WriteBehindQueue::getInstance()->stop();
+    if(_worker <= 0)
+        DAO::getInstance()->saveSnapshots();
+    EventLog::getInstance()->flush();
+    delete _responseCache;
+}
+
+#ifdef Q_OS_UNIX
+/**
+ * Create a listening socket that other worker processes can bind to the same port
+ * @return  - the socket descriptor, or -1
+ */
+static int createSharedSocket(quint16 port)
+{
+    int descriptor = ::socket(AF_INET6, SOCK_STREAM, 0);   // dual stack, like QHostAddress::Any
+    bool ipv6 = descriptor >= 0;
+    if(!ipv6)
+        descriptor = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(descriptor < 0)
+        return -1;
+
+    int on = 1, off = 0;
+    ::setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    ::setsockopt(descriptor, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+    int bound;
+    if(ipv6)
+    {
+        ::setsockopt(descriptor, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        struct sockaddr_in6 address = sockaddr_in6();
+        address.sin6_family = AF_INET6;
+        address.sin6_addr   = in6addr_any;
+        address.sin6_port   = htons(port);
+        bound = ::bind(descriptor, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+    }
+    else
+    {
+        struct sockaddr_in address = sockaddr_in();
+        address.sin_family      = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port        = htons(port);
+        bound = ::bind(descriptor, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+    }
+    if(bound != 0 || ::listen(descriptor, SOMAXCONN) != 0)
+    {
+        ::close(descriptor);
+        return -1;
+    }
+    return descriptor;
+}
+#endif
+
+/**
+ * Listen on the port, shared with the other workers under Supervisor
+ */
+bool Server::listen(quint16 port)
+{
+    if(_worker < 0)
+        return _httpServer->listen(port);
+
+#ifdef Q_OS_UNIX
+    // QHttpServer can't adopt a socket, so let it listen on a throwaway port,
+    // then swap the socket of its QTcpServer for one bound with SO_REUSEPORT
+    int descriptor = createSharedSocket(port);
+    if(descriptor < 0 || !_httpServer->listen(QHostAddress::LocalHost, 0))
+        return false;
+    QTcpServer* tcpServer = _httpServer->findChild<QTcpServer*>();
+    if(tcpServer == 0)
+        return false;
+    tcpServer->close();
+    return tcpServer->setSocketDescriptor(descriptor);
+#else
+    return _httpServer->listen(port);
+#endif
+}
+
+/**
+ * Stop accepting connections, and quit once every open request is answered
+ * Under Supervisor, the next generation, or the other workers, take the new connections.
+ * Requests that take longer than 10 seconds are abandoned
+ */
+void Server::shutdown()
+{
+    if(_shuttingDown)
+        return;
+    _shuttingDown = true;
+    LOG_INFO("server", tr("shutting down open=%1").arg(_openResponses));
+
+    _httpServer->close();
+
+    // the queued requests would only run after the running ones, and may not before quit()
+    foreach(RequestTask* task, _admission->takeWaiting())
+        reject(task);
+
+    if(_openResponses == 0)
+        QCoreApplication::quit();
+    else
+        QTimer::singleShot(10000, QCoreApplication::instance(), SLOT(quit()));
+}
+
+void Server::onResponseDestroyed()
+{
+    if(--_openResponses == 0 && _shuttingDown)
+        QCoreApplication::quit();
+}
+
+// Compares the in-memory graph with the database, off the I/O thread
+class GraphChecker : public QRunnable
+{
+public:
+    void run()
+    {
+        DAO::getInstance()->checkGraph(Settings::getInstance()->getGraphCheckSample());
+        DAO::getInstance()->closeDatabase();   // of the pool's thread
+    }
+};
+
+void Server::onCheckGraph() {
+    QThreadPool::globalInstance()->start(new GraphChecker);
+}
+
+/**
+ * Map an action, i.e., the action parameter of a request, to its handler
+ */
+void Server::registerHandler(const QString& action, Handler handler)
+{
+    _handlers.insert(action, handler);
+
+    Metrics* metrics = Metrics::getInstance();
+    QString labels = tr("action=\"%1\"").arg(action);
+    ActionMetrics actionMetrics;
+    actionMetrics.latency  = metrics->getHistogram("faqs_request_duration_seconds", labels);
+    actionMetrics.requests = metrics->getCounter  ("faqs_requests_total",           labels);
+    actionMetrics.errors   = metrics->getCounter  ("faqs_errors_total",             labels);
+    _actionMetrics.insert(action, actionMetrics);
+}
+
+/**
+ * Record a finished request of a registered action
+ * @param microseconds  - from its arrival to its reply
+ */
+void Server::recordRequest(const QString& action, int statusCode, qint64 microseconds)
+{
+    if(!_actionMetrics.contains(action))   // unknown actions are not recorded, they would flood the labels
+        return;
+
+    const ActionMetrics& actionMetrics = _actionMetrics[action];
+    Metrics* metrics = Metrics::getInstance();
+    metrics->observe(actionMetrics.latency, microseconds);
+    metrics->add(actionMetrics.requests);
+    if(statusCode >= 400)
+        metrics->add(actionMetrics.errors);
 }
 
 /**
@@ -35,206 +306,583 @@ Server::Server()
  */
 void Server::onRequest(QHttpRequest* req, QHttpResponse* res)
 {
-    QString url = req->url().toString();
-    if(!url.startsWith("/?action"))
+    QElapsedTimer timer;
+    timer.start();
+
+    // the response is deleted once it's sent, or its client is gone
+    ++_openResponses;
+    connect(res, SIGNAL(destroyed()), this, SLOT(onResponseDestroyed()));
+
+    // actions look like /?action=XXX&..., anything else is a file
+    QByteArray query = req->url().query(QUrl::FullyEncoded).toLatin1();
+    if(req->url().path() != "/" || !query.startsWith("action"))
+    {
+        processStaticResourceRequest(req, res);
+        return;
+    }
+
+    Parameters params = parseParameters(query);   // parameters in the request
+    QString action = params.value("action");
+    if(action == "submitphoto")   // handled on this thread, it needs the request's body
+    {
+        processSubmitPhotoRequest(params, req, res);
+        return;
+    }
+    // health checks and metrics are answered right here, never queued behind other work
+    if(action == "ping" || action == "metrics")
+    {
+        Reply reply = (this->*_handlers[action])(params, QByteArray());
+        sendReply(reply, res);
+        recordRequest(action, reply.statusCode, timer.nsecsElapsed() / 1000);
+        return;
+    }
+
+    Handler handler = _handlers.value(action);
+    if(handler == 0)
+    {
+        sendReply(Reply(400, tr("Unknown action %1").arg(action).toUtf8()), res);
+        return;
+    }
+
+    // run the handler on a worker thread, the reply comes back via onTaskFinished()
+    RequestTask* task = new RequestTask(this, action, handler, params, req->header("accept-encoding"), res);
+    connect(task, SIGNAL(finished()), this, SLOT(onTaskFinished()), Qt::QueuedConnection);
+    Tracer* tracer = Tracer::getInstance();
+    task->setTraced((params.value("trace") == "1" && tracer->allowRequested(QHostAddress(req->remoteAddress()))) ||
+                    tracer->shouldSample());
+
+    // a POST handler needs the whole body first
+    if(req->method() == QHttpRequest::HTTP_POST)
+    {
+        if(req->header("content-length").toLongLong() > Settings::getInstance()->getMaxBodySize())
+        {
+            delete task;
+            sendReply(Reply(413, tr("Request body too large").toUtf8()), res);
+            recordRequest(action, 413, timer.nsecsElapsed() / 1000);
+            return;
+        }
+        // the limit is enforced on the bytes received too, as chunked bodies have no length
+        _waitingForBody.insert(req, task);
+        connect(req, SIGNAL(data(QByteArray)),  this, SLOT(onBodyData(QByteArray)));
+        connect(req, SIGNAL(end()),             this, SLOT(onBodyReceived()));
+        connect(req, SIGNAL(destroyed(QObject*)), this, SLOT(onRequestDestroyed(QObject*)));
+        return;
+    }
+
+    admit(task);
+}
+
+/**
+ * Hand a task to the admission controller, or reject it if its action is saturated
+ */
+void Server::admit(RequestTask* task)
+{
+    if(!_admission->submit(task))
+        reject(task);
+}
+
+void Server::reject(RequestTask* task)
+{
+    if(QHttpResponse* res = task->getResponse())
+        sendReply(createBusyReply(), res);
+    recordRequest(task->getAction(), 503, task->getElapsed());
+    delete task;
+}
+
+/**
+ * A chunk of a POST request's body has arrived
+ * Past MaxBodySize, the request is answered with 413, and the connection closed
+ */
+void Server::onBodyData(const QByteArray& data)
+{
+    QHttpRequest* req = static_cast<QHttpRequest*>(sender());
+    RequestTask* task = _waitingForBody.value(req);
+    if(task == 0)
+        return;
+
+    if(task->getBodySize() + data.size() <= Settings::getInstance()->getMaxBodySize())
     {
-        processStaticResourceRequest(url, res);
+        task->appendBody(data);
         return;
     }
 
-    url.remove(0, 2);  // remove "/?"
-    Parameters params = parseParameters(url);   // parameters in the request
-    QString action = params["action"];
-    if(action == "ping")
-        processPingRequest(params, res);
-    else if(action == "save")
-        processSaveRequest(params, res);
-    else if(action == "logapi")
-        processLogDocumentReadingRequest(params, res);
-    else if(action == "loganswer")
-        processLogAnswerClickingRequest(params, res);
-    else if(action == "query")
-        processQueryRequest(params, res);
-    else if(action == "personal")
-        processQueryUserProfileRequest(params, res);
-    else if(action == "submitphoto")
+    _waitingForBody.remove(req);
+    disconnect(req, 0, this, 0);   // the rest of the body is ignored
+    if(QHttpResponse* res = task->getResponse())
     {
-        processSubmitPhotoRequest(params, res);
-        connect(req, SIGNAL(end()), this, SLOT(onPhotoDone()));
-        req->storeBody();  // the request object will store the data internally. WHY?
+        Reply reply(413, tr("Request body too large").toUtf8());
+        reply.headers.insert("Connection", "close");
+        sendReply(reply, res);
     }
+    recordRequest(task->getAction(), 413, task->getElapsed());
+    delete task;
 }
 
 /**
- * Parse a request URL and get its parameters
- * e.g., the URL is XXX/?action=query&apisig=YYY
- * @param url   - the URL
- * @return      - a Parameters object
+ * The body of a POST request has arrived, its handler can run now
+ */
+void Server::onBodyReceived()
+{
+    QHttpRequest* req = static_cast<QHttpRequest*>(sender());
+    RequestTask* task = _waitingForBody.take(req);
+    if(task != 0)
+        admit(task);
+}
+
+/**
+ * The client has gone before the whole body arrived
+ * @param req   - being destroyed, only used as the key
+ */
+void Server::onRequestDestroyed(QObject* req) {
+    delete _waitingForBody.take(static_cast<QHttpRequest*>(req));
+}
+
+/**
+ * Write the reply of a finished task to its response, on the connection's thread
  */
-Server::Parameters Server::parseParameters(const QString& url) const
+void Server::onTaskFinished()
 {
-    Parameters result;
-    if(url.isEmpty())
-        return result;
+    RequestTask* task = static_cast<RequestTask*>(sender());
+    _admission->release(task->getAction());
+    if(QHttpResponse* res = task->getResponse())  // null if the client has gone
+        sendReply(task->getReply(), res);
+    recordRequest(task->getAction(), task->getReply().statusCode, task->getElapsed());
+    task->deleteLater();
+}
+
+/**
+ * Write a reply to the client and finish the response
+ * @param reply - the reply created by a handler
+ * @param res   - response object
+ */
+void Server::sendReply(const Reply& reply, QHttpResponse* res)
+{
+    static const int histogram = Metrics::getInstance()->getHistogram("faqs_stage_duration_seconds", "stage=\"write\"");
+    static const int bytes     = Metrics::getInstance()->getCounter  ("faqs_sent_bytes_total");
+    LatencyTimer timer(histogram);
+    Metrics::getInstance()->add(bytes, reply.body.size());
+
+    for(QMap<QString, QString>::ConstIterator it = reply.headers.begin(); it != reply.headers.end(); ++it)
+        res->setHeader(it.key(), it.value());
+    res->writeHead(reply.statusCode);
+    res->write(reply.body);
+    res->end();
+}
+
+/**
+ * Parse the query string of a request URL and get its parameters
+ * e.g., the URL is XXX/?action=query&apisig=YYY, the query string is action=query&apisig=YYY
+ * @param query - the percent-encoded query string
+ * @return      - a Parameters object
+ */
+Server::Parameters Server::parseParameters(const QByteArray& query) const {
+    return QueryString::parse(query);
+}
 
-    QStringList sections = url.split("&");
-    if(sections.length() == 0)
-        return result;
+/**
+ * Write an event to the database, or queue it for the writer thread
+ * @return  - false if the event can not be accepted now
+ */
+bool Server::submitWrite(const WriteEvent& event)
+{
+    if(_writeForwarder && _writeForwarder->forward(event))
+        return true;
 
-    foreach(const QString& section, sections)
-        result.insert(section.section('=', 0,  0),   // left part of the 1st =
-                      section.section('=', 1, -1));  // right of the =
+    QMutexLocker locker(&_submitMutex);
+    if(_writeBehind)
+    {
+        if(!WriteBehindQueue::getInstance()->enqueue(event))
+            return false;
+    }
+    else if(!DAO::getInstance()->apply(event))
+        return false;
 
-    return result;
+    DAO::getInstance()->stage(event);   // readers see it now, even if it's still queued
+    return true;
 }
 
 /**
  * Process ping request and respond with a pong
  * @param params    - parameters of the request
- * @param res       - response
+ * @return          - reply to the client
  */
-void Server::processPingRequest(const Parameters& params, QHttpResponse* res)
+Reply Server::processPingRequest(const Parameters& params, const QByteArray&)
 {
-    res->setHeader("Content-Type", "text/html");
-    res->writeHead(200);
     QString userName = params.contains("username") ? params["username"] : "anonymous";
-    res->write(tr("Hello %1, I'm alive!").arg(userName).toUtf8());
-    res->end();
+    return Reply(200, tr("Hello %1, I'm alive!").arg(userName).toUtf8());
 }
 
 /**
  * Process saving FAQ request
  * @param params    - parameters of the request
- * @param res       - response
+ * @return          - reply to the client
  */
-void Server::processSaveRequest(const Parameters& params, QHttpResponse* res)
+Reply Server::processSaveRequest(const Parameters& params, const QByteArray&)
 {
-    // link and title may contain percentage encoded reserved chars, such as & < > #
-    // convert them back to human readable chars
-    DAO::getInstance()->save(params["username"],
-                             params["email"],
-                             params["apisig"],
-                             params["question"],
-                             QUrl::fromPercentEncoding(params["link"] .toUtf8()),
-                             QUrl::fromPercentEncoding(params["title"].toUtf8()));
+    WriteEvent event;
+    event.type     = WriteEvent::Save;
+    event.userName = params["username"];
+    event.email    = params["email"];
+    event.apiSig   = params["apisig"];
+    event.question = params["question"];
+    event.link     = params["link"];
+    event.title    = params["title"];
+    if(!submitWrite(event))
+        return createBusyReply();
 
-    res->setHeader("Content-Type", "text/html");
-    res->writeHead(200);
-    res->write(tr("Your FAQ is saved").toUtf8());
-    res->end();
+    return Reply(200, tr("Your FAQ is saved").toUtf8());
 }
 
 /**
  * Process log document reading request
  * @param params    - parameters of the request
- * @param res       - response
+ * @return          - reply to the client
  */
-void Server::processLogDocumentReadingRequest(const Server::Parameters& params, QHttpResponse* res)
+Reply Server::processLogDocumentReadingRequest(const Server::Parameters& params, const QByteArray&)
 {
-    DAO::getInstance()->logDocumentReading(params["username"],
-                               params["email"],
-                               params["apisig"]);
+    WriteEvent event;
+    event.type     = WriteEvent::LogDocumentReading;
+    event.userName = params["username"];
+    event.email    = params["email"];
+    event.apiSig   = params["apisig"];
+    if(!submitWrite(event))
+        return createBusyReply();
 
-    res->setHeader("Content-Type", "text/html");
-    res->writeHead(200);
-    res->write(tr("Your API is logged").toUtf8());
-    res->end();
+    return Reply(200, tr("Your API is logged").toUtf8());
 }
 
 /**
  * Process log answer clicking request
  * @param params    - parameters of the request
- * @param res       - response
+ * @return          - reply to the client
  */
-void Server::processLogAnswerClickingRequest(const Server::Parameters& params, QHttpResponse* res)
+Reply Server::processLogAnswerClickingRequest(const Server::Parameters& params, const QByteArray&)
 {
-    // link may contain percentage encoded reserved chars, such as & < > #
-    // convert them back to human readable chars
-    DAO::getInstance()->logAnswerClicking(params["username"],
-                                  params["email"],
-                                  QUrl::fromPercentEncoding(params["link"] .toUtf8()));
+    WriteEvent event;
+    event.type     = WriteEvent::LogAnswerClicking;
+    event.userName = params["username"];
+    event.email    = params["email"];
+    event.link     = params["link"];
+    if(!submitWrite(event))
+        return createBusyReply();
 
-    res->setHeader("Content-Type", "text/html");
-    res->writeHead(200);
-    res->write(tr("Your Answer is logged").toUtf8());
-    res->end();
+    return Reply(200, tr("Your Answer is logged").toUtf8());
+}
+
+/**
+ * Process a batch of telemetry events, sent as the POST body, one JSON object per line, e.g.,
+ * {"action": "save", "username": "Carl", "email": "carl@gmail.com", "apisig": "...", "question": "...", "link": "...", "title": "..."}
+ * {"action": "logapi", "username": "Carl", "email": "carl@gmail.com", "apisig": "..."}
+ * {"action": "loganswer", "username": "Carl", "email": "carl@gmail.com", "link": "..."}
+ * The events take the path of the single writes, so that under Supervisor only the writer
+ * process writes, and the graph gets them in the order they are persisted. In immediate
+ * durability mode they are applied in one transaction, and "ok" means saved; in batched mode
+ * they are queued, and "ok" means accepted, like the 200 of a single write.
+ * The client learns the status of each: {"results": ["ok", "error: missing apisig", ...]}
+ * @param body  - the events
+ * @return      - reply to the client
+ */
+Reply Server::processBatchRequest(const Server::Parameters&, const QByteArray& body)
+{
+    QList<QByteArray> lines = body.split('\n');
+    QStringList results;
+    QList<WriteEvent> events;
+    QList<int>        eventLines;   // event -> its index in results
+    foreach(const QByteArray& line, lines)
+    {
+        if(line.trimmed().isEmpty())
+            continue;
+
+        QJsonObject joEvent = QJsonDocument::fromJson(line).object();
+        QString action = joEvent.value("action").toString();
+        WriteEvent event;
+        if(action == "save")
+            event.type = WriteEvent::Save;
+        else if(action == "logapi")
+            event.type = WriteEvent::LogDocumentReading;
+        else if(action == "loganswer")
+            event.type = WriteEvent::LogAnswerClicking;
+        else
+        {
+            results << (joEvent.isEmpty() ? "error: invalid json" : "error: unknown action " + action);
+            continue;
+        }
+        event.userName = joEvent.value("username").toString();
+        event.email    = joEvent.value("email")   .toString();
+        event.apiSig   = joEvent.value("apisig")  .toString();
+        event.question = joEvent.value("question").toString();
+        event.link     = joEvent.value("link")    .toString();
+        event.title    = joEvent.value("title")   .toString();
+
+        eventLines << results.size();
+        results    << QString();   // filled in below
+        events     << event;
+    }
+
+    QStringList eventResults;
+    if(_writeBehind)
+        foreach(const WriteEvent& event, events)
+        {
+            QString error = DAO::validate(event);
+            eventResults << (!error.isEmpty() ? "error: " + error
+                                              : submitWrite(event) ? QString("ok") : QString("error: busy"));
+        }
+    else
+    {
+        QMutexLocker locker(&_submitMutex);   // applyBatch stages the saved events
+        eventResults = DAO::getInstance()->applyBatch(events);
+    }
+    for(int i = 0; i < eventLines.size(); ++i)
+        results[eventLines[i]] = eventResults.value(i);
+
+    QJsonObject joResults;
+    joResults.insert("results", QJsonArray::fromStringList(results));
+    return Reply(200, QJsonDocument(joResults).toJson(QJsonDocument::Compact), "application/json");
+}
+
+/**
+ * Export the latency histograms and counters in Prometheus text format
+ * @return  - reply to the client
+ */
+Reply Server::processMetricsRequest(const Server::Parameters&, const QByteArray&) {
+    return Reply(200, Metrics::getInstance()->toPrometheus(), "text/plain; version=0.0.4");
 }
 
 /**
  * Process query FAQs request
  * @param params    - parameters of the request
- * @param res       - response
+ * @return          - reply to the client
  */
-void Server::processQueryRequest(const Server::Parameters& params, QHttpResponse* res)
+Reply Server::processQueryRequest(const Server::Parameters& params, const QByteArray&)
 {
-    QJsonArray jaFAQs = DAO::getInstance()->queryFAQs(params["class"]).array();
+    QString classSig = params["class"];
+    Reply reply;
+    int   generation;
+    if(_responseCache->lookup(classSig, reply, generation))
+        return reply;
+
+    QJsonArray jaFAQs = DAO::getInstance()->queryFAQs(classSig).array();
     if(jaFAQs.isEmpty())   // returned is a json array
-        return;
-    res->setHeader("Content-Type", "text/html");
-    res->writeHead(200);
-    QJsonDocument jdSnippet = SnippetCreator().createFAQs(jaFAQs);  // create html, encapsulated in a json doc
-    res->write(jdSnippet.toJson());
-    res->end();
+        reply = Reply(204);
+    else
+    {
+        QJsonDocument jdSnippet = SnippetCreator().createFAQs(jaFAQs);  // create html, encapsulated in a json doc
+        reply = Reply(200, jdSnippet.toJson());
+    }
+    _responseCache->insert(classSig, reply, generation);
+    return reply;
 }
 
 /**
  * Process query user profile request
  * @param params    - parameters of the request
- * @param res       - response
+ * @return          - reply to the client
  */
-void Server::processQueryUserProfileRequest(const Server::Parameters& params, QHttpResponse* res)
+Reply Server::processQueryUserProfileRequest(const Server::Parameters& params, const QByteArray&)
 {
     QJsonDocument json = DAO::getInstance()->queryUserProfile(params["username"]);
-    res->setHeader("Content-Type", "text/html");
-    res->writeHead(200);
-    res->write(SnippetCreator().createProfilePage(json.object()));
-    res->end();
-
-    qDebug() << SnippetCreator().createProfilePage(json.object());
+    QByteArray page = SnippetCreator().createProfilePage(json.object());
+    LOG_PAYLOAD("server", QString::fromUtf8(page));
+    return Reply(200, page);
 }
 
 /**
  * Process user photo submission
- * @param params
- * @param res
+ * The photo is streamed to disk as it arrives, and the response is sent once it is saved
+ * @param params    - parameters of the request
+ * @param req       - the request, carrying the photo in its body
+ * @param res       - response
  */
-void Server::processSubmitPhotoRequest(const Server::Parameters& params, QHttpResponse* res)
+void Server::processSubmitPhotoRequest(const Server::Parameters& params, QHttpRequest* req, QHttpResponse* res)
 {
-    _photoUser = params["username"];
-    res->writeHead(200);
-    res->write("Accepting photo ...");
-    // do not call res->end(), because the photo transfer is not finished
+    // the upload connects to the request's data() signal right away,
+    // before control returns to the event loop, so no chunk is missed
+    new PhotoUpload(req, res, params["username"], Settings::getInstance()->getPhotoMaxSize());
+
+    // PNG, JPEG and GIF are all saved as Photos/<user>.png, the URL the snippets link to.
+    // StaticCache serves a photo with the type its first bytes tell
+}
+
+/**
+ * Format a time as an HTTP date, e.g., Sun, 06 Nov 1994 08:49:37 GMT
+ */
+static QString toHttpDate(const QDateTime& time) {
+    return QLocale::c().toString(time.toUTC(), "ddd, dd MMM yyyy hh:mm:ss") + " GMT";
 }
 
+enum RangeResult {NoRange, ValidRange, InvalidRange};
+
 /**
- * Save the photo when the transfer is done
+ * Parse a single byte range, e.g., bytes=0-499, bytes=500-, bytes=-500
+ * Multiple ranges are not supported, the whole file is sent for them
+ * @param header    - value of the Range header
+ * @param size      - size of the file
+ * @param first     - output, first byte of the range
+ * @param last      - output, last byte of the range, inclusive
  */
-void Server::onPhotoDone()
+static RangeResult parseRange(const QString& header, qint64 size, qint64& first, qint64& last)
 {
-    QHttpRequest* req = static_cast<QHttpRequest*>(sender());
-    QDir::current().mkdir("Photos");
-    QFile file("./Photos/" + _photoUser + ".png");
-    if(file.open(QFile::WriteOnly))
-        file.write(req->body());
+    if(!header.startsWith("bytes=") || header.contains(','))
+        return NoRange;
+
+    QString spec  = header.mid(6).trimmed();
+    QString left  = spec.section('-', 0, 0).trimmed();
+    QString right = spec.section('-', 1, 1).trimmed();
+    bool okLeft, okRight;
+    qint64 from = left .toLongLong(&okLeft);
+    qint64 to   = right.toLongLong(&okRight);
+
+    if(left.isEmpty() && okRight)         // suffix: the last n bytes
+    {
+        if(to <= 0)
+            return InvalidRange;
+        first = qMax<qint64>(size - to, 0);
+        last  = size - 1;
+    }
+    else if(okLeft && right.isEmpty())    // from n to the end
+    {
+        first = from;
+        last  = size - 1;
+    }
+    else if(okLeft && okRight && from <= to) {
+        first = from;
+        last  = qMin(to, size - 1);
+    }
+    else
+        return NoRange;   // malformed, ignore it
 
-    // FIXME: Regardless of the input file type, photos are saved as png. Test this!
+    return first < size ? ValidRange : InvalidRange;
 }
 
 /**
  * Process static web page request
- * @param url   - requested URL
+ * Small files are served from StaticCache, large ones are streamed from disk.
+ * Supports validation with ETag or Last-Modified, and single byte ranges
+ * @param req   - the request
  * @param res   - response
  */
-void Server::processStaticResourceRequest(const QString& url, QHttpResponse* res)
+void Server::processStaticResourceRequest(QHttpRequest* req, QHttpResponse* res)
 {
-    QFile file("." + url);
-    if(file.open(QFile::ReadOnly))  // open the local file and send it back
+    static const int requests = Metrics::getInstance()->getCounter("faqs_static_requests_total");
+    Metrics::getInstance()->add(requests);
+
+    // only serve files under the working directory
+    QString path = QDir::cleanPath(req->url().path());
+    QFileInfo fileInfo("." + path);
+    if(path.contains("..") || !fileInfo.isFile())
     {
-        res->writeHead(200);
-        res->write(file.readAll());
+        res->writeHead(404);
+        res->end();
+        return;
     }
-    else {
+
+    Settings* settings = Settings::getInstance();
+    bool streamed = fileInfo.size() > settings->getStaticStreamThreshold();
+    StaticCache::Entry entry;
+    if(streamed)
+        entry = StaticCache::describe(fileInfo);
+    else if(!_staticCache->lookup(fileInfo.filePath(), entry))
+    {
         res->writeHead(404);
+        res->end();
+        return;
     }
-    res->end();
+    // the precompressed variant is a different representation, with its own ETag
+    // ranges are only served from the identity representation
+    bool gzipped = !entry.gzipped.isEmpty() && req->header("range").isEmpty() &&
+                   Compressor::negotiate(req->header("accept-encoding")) == "gzip";
+    if(gzipped)
+    {
+        entry.content = entry.gzipped;
+        entry.eTag.insert(entry.eTag.size() - 1, "-gz");
+        res->setHeader("Content-Encoding", "gzip");
+    }
+    if(!entry.gzipped.isEmpty())
+        res->setHeader("Vary", "Accept-Encoding");
+
+    qint64 size = streamed ? fileInfo.size() : entry.content.size();
+
+    res->setHeader("ETag",          entry.eTag);
+    res->setHeader("Last-Modified", toHttpDate(entry.lastModified));
+    res->setHeader("Cache-Control", tr("public, max-age=%1").arg(settings->getStaticMaxAge()));
+    res->setHeader("Accept-Ranges", "bytes");
+
+    // the client's copy is still good
+    QString ifNoneMatch     = req->header("if-none-match");
+    QString ifModifiedSince = req->header("if-modified-since");
+    bool notModified = ifNoneMatch.isEmpty()
+            ? !ifModifiedSince.isEmpty() && ifModifiedSince == toHttpDate(entry.lastModified)
+            : ifNoneMatch.trimmed() == "*" || ifNoneMatch.contains(QString(entry.eTag));
+    if(notModified)
+    {
+        res->writeHead(304);
+        res->end();
+        return;
+    }
+
+    // a range is only honored if the client's partial copy is of the current version
+    qint64 first = 0;
+    qint64 last  = size - 1;
+    QString ifRange = req->header("if-range");
+    RangeResult range = ifRange.isEmpty() || ifRange == QString(entry.eTag)
+            ? parseRange(req->header("range"), size, first, last)
+            : NoRange;
+    if(range == InvalidRange)
+    {
+        res->setHeader("Content-Range", tr("bytes */%1").arg(size));
+        res->writeHead(416);
+        res->end();
+        return;
+    }
+
+    res->setHeader("Content-Type",   entry.mimeType);
+    res->setHeader("Content-Length", QString::number(last - first + 1));
+    if(range == ValidRange)
+    {
+        res->setHeader("Content-Range", tr("bytes %1-%2/%3").arg(first).arg(last).arg(size));
+        res->writeHead(206);
+    }
+    else
+        res->writeHead(200);
+
+    if(!streamed)
+    {
+        res->end(entry.content.mid(first, last - first + 1));
+        return;
+    }
+
+    FileSender* fileSender = new FileSender(res, findSocket(req), fileInfo.filePath(), first, last - first + 1);
+    if(!fileSender->start())   // the file went away, the head is sent already, so just close
+    {
+        delete fileSender;
+        res->end();
+    }
+}
+
+/**
+ * An IPv4-mapped IPv6 address, e.g., ::ffff:127.0.0.1, as the IPv4 address it maps
+ * The dual stack socket reports IPv4 clients so, and their text forms differ
+ */
+static QHostAddress normalized(const QHostAddress& address)
+{
+    bool isIPv4 = false;
+    quint32 ipv4 = address.toIPv4Address(&isIPv4);
+    return isIPv4 ? QHostAddress(ipv4) : address;
+}
+
+/**
+ * Find the socket a request came from, so that large bodies can be paced
+ * QHttpServer does not expose it, but its sockets are children of the server.
+ * Only streamed files look for it. The port rules out nearly all the other sockets, the
+ * address is parsed once, and compared as an address
+ * @return  - the socket, or null if not found
+ */
+QTcpSocket* Server::findSocket(QHttpRequest* req) const
+{
+    quint16      port    = req->remotePort();
+    QHostAddress address = normalized(QHostAddress(req->remoteAddress()));
+    foreach(QTcpSocket* socket, _httpServer->findChildren<QTcpSocket*>())
+        if(socket->peerPort() == port && normalized(socket->peerAddress()) == address)
+            return socket;
+    return 0;
 }
@@ -1,32 +1,96 @@
-﻿#include "qhttpserverfwd.h"
+﻿#ifndef SERVER_H
+#define SERVER_H
+
+#include "qhttpserverfwd.h"
+#include "Reply.h"
+#include "WriteEvent.h"
 
 #include <QObject>
+#include <QMap>
+#include <QHash>
+#include <QMutex>
+
+class QThreadPool;
+class StaticCache;
+class ResponseCache;
+class RequestTask;
+class AdmissionController;
+class WriteForwarder;
+class WriteReceiver;
 
 // 一个Web服务器
 class Server : public QObject
 {
     Q_OBJECT
-    typedef QMap<QString, QString> Parameters;   // parameter name -> parameter value, e.g., username=Carl
 
 public:
-    Server();
+    typedef QHash<QString, QString> Parameters;  // parameter name -> parameter value, e.g., username=Carl
+    typedef Reply (Server::*Handler)(const Parameters& params, const QByteArray& body);  // action handler, runs on a worker thread
+
+public:
+    Server(int worker = -1, int generation = 0);   // worker index under Supervisor, -1 if alone
+    ~Server();
+
+public slots:
+    void shutdown();   // stop accepting, finish the open requests, then quit
 
 private slots:
     void onRequest(QHttpRequest* req, QHttpResponse* res);
-    void onPhotoDone();
+    void onTaskFinished();
+    void onBodyData(const QByteArray& data);
+    void onBodyReceived();
+    void onRequestDestroyed(QObject* req);
+    void onResponseDestroyed();
+    void onCheckGraph();
+
+private:
+    bool listen(quint16 port);
+    void registerHandler(const QString& action, Handler handler);
+    Parameters parseParameters(const QByteArray& query) const;
+    void sendReply(const Reply& reply, QHttpResponse* res);
+    bool submitWrite(const WriteEvent& event);
+    void admit(RequestTask* task);
+    void reject(RequestTask* task);   // answer 503, and delete the task
+    void recordRequest(const QString& action, int statusCode, qint64 microseconds);
+
+    Reply processPingRequest                (const Parameters& params, const QByteArray& body);
+    Reply processSaveRequest                (const Parameters& params, const QByteArray& body);
+    Reply processLogDocumentReadingRequest  (const Parameters& params, const QByteArray& body);
+    Reply processLogAnswerClickingRequest   (const Parameters& params, const QByteArray& body);
+    Reply processQueryRequest               (const Parameters& params, const QByteArray& body);
+    Reply processQueryUserProfileRequest    (const Parameters& params, const QByteArray& body);
+    Reply processBatchRequest               (const Parameters& params, const QByteArray& body);
+    Reply processMetricsRequest             (const Parameters& params, const QByteArray& body);
+    void processSubmitPhotoRequest(const Parameters& params, QHttpRequest* req, QHttpResponse* res);
+    void processStaticResourceRequest(QHttpRequest* req, QHttpResponse* res);
+    QTcpSocket* findSocket(QHttpRequest* req) const;
+
+    friend class RequestTask;
 
 private:
-    Parameters parseParameters(const QString& url) const;
-    void processPingRequest                 (const Parameters& params, QHttpResponse* res);
-    void processSaveRequest                 (const Parameters& params, QHttpResponse* res);
-    void processLogDocumentReadingRequest   (const Parameters& params, QHttpResponse* res);
-    void processLogAnswerClickingRequest    (const Parameters& params, QHttpResponse* res);
-    void processQueryRequest                (const Parameters& params, QHttpResponse* res);
-    void processQueryUserProfileRequest     (const Parameters& params, QHttpResponse* res);
-    void processSubmitPhotoRequest          (const Parameters& params, QHttpResponse* res);
-    void processStaticResourceRequest(const QString& url, QHttpResponse* res);
+    struct ActionMetrics   // ids of an action's series in Metrics
+    {
+        int latency;    // histogram, from arrival to reply
+        int requests;   // counter
+        int errors;     // counter, replies with status >= 400
+    };
 
 private:
-    QString _photoUser;
+    QHttpServer* _httpServer;
+    int          _worker;          // index under Supervisor, -1 if alone; worker 0 writes
+    int          _openResponses;   // requests not answered yet
+    bool         _shuttingDown;
+    QThreadPool* _pool;          // executes action handlers off the I/O thread
+    AdmissionController* _admission;   // per action concurrency limits, queues and priorities
+    QHash<QString, Handler> _handlers;   // action -> handler
+    QHash<QString, ActionMetrics> _actionMetrics;   // action -> its series
+    QHash<QHttpRequest*, RequestTask*> _waitingForBody;   // POST requests whose body is on its way
+    bool         _writeBehind;   // queue writes instead of writing them in the handler
+    QMutex       _submitMutex;   // the in-memory graph gets the writes in the order they are persisted
+    WriteForwarder* _writeForwarder;   // in a worker other than the writer, sends writes to it
+    WriteReceiver*  _writeReceiver;    // in the writer, queues the writes of other workers
+    StaticCache* _staticCache;   // style sheets and photos
+    ResponseCache* _responseCache;   // rendered FAQs of classes
 };
 
+#endif // SERVER_H
@@ -1,22 +1,122 @@
 ﻿#include "Settings.h"
 
 #include <QFile>
+#include <QThread>
+#include <QStringList>
 
 // Singleton方法
 Settings* Settings::getInstance()
 {
-    if(_instance == 0)
-        _instance = new Settings();
-    return _instance;
+    static Settings* instance = new Settings;
+    return instance;
 }
 
 QString Settings::getServerIP()   const { return value("IP")    .toString(); }
 uint    Settings::getServerPort() const { return value("Port")  .toUInt();   }
 double  Settings::getSimilarityThreshold()  const { return value("SimilarityThreshold").toDouble(); }
+int     Settings::getWorkerThreads()        const { return qMax(value("WorkerThreads", QThread::idealThreadCount()).toInt(), 1); }
+int     Settings::getProcesses()            const { return qMax(value("Processes", 1).toInt(), 1); }
+QString Settings::getDurability()           const { return value("Durability", "batched").toString(); }
+int     Settings::getWriteQueueCapacity()   const { return qMax(value("WriteQueueCapacity", 10000).toInt(), 1); }
+int     Settings::getWriteBatchSize()       const { return qMax(value("WriteBatchSize",     200)  .toInt(), 1); }
+int     Settings::getWriteFlushInterval()   const { return qMax(value("WriteFlushInterval", 100)  .toInt(), 0); }
+qint64  Settings::getStaticCacheSize()      const { return value("StaticCacheSize", 32 * 1024 * 1024).toLongLong(); }
+int     Settings::getStaticMaxAge()         const { return value("StaticMaxAge", 600).toInt(); }
+qint64  Settings::getStaticStreamThreshold() const { return value("StaticStreamThreshold", 256 * 1024).toLongLong(); }
+qint64  Settings::getResponseCacheSize()    const { return value("ResponseCacheSize", 16 * 1024 * 1024).toLongLong(); }
+int     Settings::getCompressionThreshold() const { return value("CompressionThreshold", 1024).toInt(); }
+qint64  Settings::getPhotoMaxSize()         const { return value("PhotoMaxSize", 2 * 1024 * 1024).toLongLong(); }
+qint64  Settings::getMaxBodySize()          const { return value("MaxBodySize",  4 * 1024 * 1024).toLongLong(); }
+QString Settings::getLogLevel()             const { return value("LogLevel", "info").toString(); }
+QString Settings::getLogFile()              const { return value("LogFile").toString(); }
+int     Settings::getLogSampleRate()        const { return qMax(value("LogSampleRate", 100) .toInt(), 1); }
+int     Settings::getLogBufferSize()        const { return qMax(value("LogBufferSize", 8192).toInt(), 2); }
+double  Settings::getTraceSampleRate()      const { return value("TraceSampleRate", 0).toDouble(); }
+bool    Settings::getTraceOnRequest()       const { return value("TraceOnRequest", false).toBool(); }
+int     Settings::getTraceRequestRate()     const { return qMax(value("TraceRequestRate", 10).toInt(), 0); }
+int     Settings::getTraceMaxFiles()        const { return qMax(value("TraceMaxFiles", 100).toInt(), 1); }
+int     Settings::getRelatedUsersLimit()    const { return qMax(value("RelatedUsersLimit", 20).toInt(), 0); }
+int     Settings::getSnapshotInterval()     const { return qMax(value("SnapshotInterval", 300).toInt(), 1); }
+bool    Settings::getFAQGraph()             const { return value("FAQGraph", true).toBool(); }
+int     Settings::getGraphCheckInterval()   const { return qMax(value("GraphCheckInterval", 3600).toInt(), 0); }
+int     Settings::getGraphCheckSample()     const { return qMax(value("GraphCheckSample", 20).toInt(), 1); }
+int     Settings::getEventBlockSize()       const { return qMax(value("EventBlockSize", 4096).toInt(), 1); }
+int     Settings::getEventFlushInterval()   const { return qMax(value("EventFlushInterval", 1000).toInt(), 0); }
+int     Settings::getEventRetentionDays()   const { return qMax(value("EventRetentionDays", 30).toInt(), 1); }
+QString Settings::getDBSynchronous()        const { return value("DBSynchronous", "normal").toString(); }
+int     Settings::getDBCacheSize()          const { return qMax(value("DBCacheSize", 8192).toInt(), 0); }
+qint64  Settings::getDBMmapSize()           const { return qMax(value("DBMmapSize", 64 * 1024 * 1024).toLongLong(), Q_INT64_C(0)); }
+
+// Default admission limits: telemetry is cheap and must not be starved,
+// profile pages are expensive and may only take a fraction of the workers
+static int defaultMaxConcurrent(const QString& action, int threads) {
+    return action == "personal" ? qMax(threads / 4, 1) : threads;
+}
+static int defaultQueueDepth(const QString& action)
+{
+    if(action == "personal")
+        return 32;
+    return action == "query" ? 256 : 1000;
+}
+static int defaultPriority(const QString& action)
+{
+    if(action == "personal")
+        return 0;
+    return action == "query" ? 1 : 2;
+}
+
+int Settings::getMaxConcurrent(const QString& action) const {
+    return value("Admission/" + action + "/MaxConcurrent", defaultMaxConcurrent(action, getWorkerThreads())).toInt();
+}
+int Settings::getQueueDepth(const QString& action) const {
+    return value("Admission/" + action + "/QueueDepth", defaultQueueDepth(action)).toInt();
+}
+int Settings::getPriority(const QString& action) const {
+    return value("Admission/" + action + "/Priority", defaultPriority(action)).toInt();
+}
 
 void Settings::setServerIP  (const QString& ip) { setValue("IP", ip); }
 void Settings::setServerPort(uint port)         { setValue("Port", port); }
 void Settings::setSimilarityThreshold(double threshold) { setValue("SimilarityThreshold", threshold); }
+void Settings::setWorkerThreads      (int count)        { setValue("WorkerThreads", count); }
+void Settings::setProcesses          (int count)        { setValue("Processes", count); }
+void Settings::setDurability         (const QString& mode) { setValue("Durability", mode); }
+void Settings::setWriteQueueCapacity (int capacity)     { setValue("WriteQueueCapacity", capacity); }
+void Settings::setWriteBatchSize     (int size)         { setValue("WriteBatchSize", size); }
+void Settings::setWriteFlushInterval (int ms)           { setValue("WriteFlushInterval", ms); }
+void Settings::setStaticCacheSize    (qint64 bytes)     { setValue("StaticCacheSize", bytes); }
+void Settings::setStaticMaxAge       (int seconds)      { setValue("StaticMaxAge", seconds); }
+void Settings::setStaticStreamThreshold(qint64 bytes)   { setValue("StaticStreamThreshold", bytes); }
+void Settings::setResponseCacheSize  (qint64 bytes)     { setValue("ResponseCacheSize", bytes); }
+void Settings::setCompressionThreshold(int bytes)       { setValue("CompressionThreshold", bytes); }
+void Settings::setPhotoMaxSize       (qint64 bytes)     { setValue("PhotoMaxSize", bytes); }
+void Settings::setMaxBodySize        (qint64 bytes)     { setValue("MaxBodySize", bytes); }
+void Settings::setLogLevel           (const QString& level) { setValue("LogLevel", level); }
+void Settings::setLogFile            (const QString& filePath) { setValue("LogFile", filePath); }
+void Settings::setLogSampleRate      (int rate)         { setValue("LogSampleRate", rate); }
+void Settings::setLogBufferSize      (int records)      { setValue("LogBufferSize", records); }
+void Settings::setTraceSampleRate    (double rate)      { setValue("TraceSampleRate", rate); }
+void Settings::setTraceOnRequest     (bool enabled)     { setValue("TraceOnRequest", enabled); }
+void Settings::setTraceRequestRate   (int perMinute)    { setValue("TraceRequestRate", perMinute); }
+void Settings::setTraceMaxFiles      (int count)        { setValue("TraceMaxFiles", count); }
+void Settings::setRelatedUsersLimit  (int count)        { setValue("RelatedUsersLimit", count); }
+void Settings::setSnapshotInterval   (int seconds)      { setValue("SnapshotInterval", seconds); }
+void Settings::setFAQGraph           (bool enabled)     { setValue("FAQGraph", enabled); }
+void Settings::setGraphCheckInterval (int seconds)      { setValue("GraphCheckInterval", seconds); }
+void Settings::setGraphCheckSample   (int size)         { setValue("GraphCheckSample", size); }
+void Settings::setEventBlockSize     (int events)       { setValue("EventBlockSize", events); }
+void Settings::setEventFlushInterval (int ms)           { setValue("EventFlushInterval", ms); }
+void Settings::setEventRetentionDays (int days)         { setValue("EventRetentionDays", days); }
+void Settings::setDBSynchronous      (const QString& mode) { setValue("DBSynchronous", mode); }
+void Settings::setDBCacheSize        (int kib)          { setValue("DBCacheSize", kib); }
+void Settings::setDBMmapSize         (qint64 bytes)     { setValue("DBMmapSize", bytes); }
+
+void Settings::setAdmission(const QString& action, int maxConcurrent, int queueDepth, int priority)
+{
+    setValue("Admission/" + action + "/MaxConcurrent", maxConcurrent);
+    setValue("Admission/" + action + "/QueueDepth",    queueDepth);
+    setValue("Admission/" + action + "/Priority",      priority);
+}
 
 Settings::Settings()
     : QSettings("FAQsServer.ini", QSettings::IniFormat)
@@ -30,8 +130,41 @@ void Settings::loadDefaults()
     setServerIP("localhost");
     setServerPort(8080);
     setSimilarityThreshold(0.75);
-}
-
-Settings* Settings::_instance = 0;
-
+    setWorkerThreads(QThread::idealThreadCount());
+    setProcesses(1);
+    setDurability("batched");
+    setWriteQueueCapacity(10000);
+    setWriteBatchSize(200);
+    setWriteFlushInterval(100);
+    setStaticCacheSize(32 * 1024 * 1024);
+    setStaticMaxAge(600);
+    setStaticStreamThreshold(256 * 1024);
+    setResponseCacheSize(16 * 1024 * 1024);
+    setCompressionThreshold(1024);
+    setPhotoMaxSize(2 * 1024 * 1024);
+    setMaxBodySize(4 * 1024 * 1024);
+    setLogLevel("info");
+    setLogFile("");
+    setLogSampleRate(100);
+    setLogBufferSize(8192);
+    setTraceSampleRate(0);
+    setTraceOnRequest(false);
+    setTraceRequestRate(10);
+    setTraceMaxFiles(100);
+    setRelatedUsersLimit(20);
+    setSnapshotInterval(300);
+    setFAQGraph(true);
+    setGraphCheckInterval(3600);
+    setGraphCheckSample(20);
+    setEventBlockSize(4096);
+    setEventFlushInterval(1000);
+    setEventRetentionDays(30);
+    setDBSynchronous("normal");
+    setDBCacheSize(8192);
+    setDBMmapSize(64 * 1024 * 1024);
 
+    QStringList actions;
+    actions << "save" << "logapi" << "loganswer" << "batch" << "query" << "personal";
+    foreach(const QString& action, actions)
+        setAdmission(action, defaultMaxConcurrent(action, getWorkerThreads()), defaultQueueDepth(action), defaultPriority(action));
+}
@@ -12,17 +12,84 @@ public:
     QString getServerIP()               const;
     uint    getServerPort()             const;
     double  getSimilarityThreshold()    const;  // 判断两个句子是否是语义一致的阈值
+    int     getWorkerThreads()          const;  // size of the request handler thread pool
+    int     getProcesses()              const;  // # of worker processes, sharing the port, 1 for no supervisor
+    QString getDurability()             const;  // "batched": ack writes once queued; "immediate": ack once written
+    int     getWriteQueueCapacity()     const;  // max # of queued write events
+    int     getWriteBatchSize()         const;  // max # of write events per transaction
+    int     getWriteFlushInterval()     const;  // max ms a queued write waits for its batch
+    qint64  getStaticCacheSize()        const;  // max bytes of static files kept in memory
+    int     getStaticMaxAge()           const;  // seconds a client may use a static file without revalidating
+    qint64  getStaticStreamThreshold()  const;  // static files larger than this are streamed, not cached
+    qint64  getResponseCacheSize()      const;  // max bytes of rendered FAQs kept in memory, 0 for none
+    int     getCompressionThreshold()   const;  // dynamic replies smaller than this (bytes) are not compressed
+    qint64  getPhotoMaxSize()           const;  // max bytes of an uploaded photo
+    qint64  getMaxBodySize()            const;  // max bytes of a POST body, e.g., a batch
+    QString getLogLevel()               const;  // least severe level logged: debug, info, warning or error
+    QString getLogFile()                const;  // empty for stderr
+    int     getLogSampleRate()          const;  // 1 in this many payload dumps is logged
+    int     getLogBufferSize()          const;  // # of records the logger buffers, rounded up to a power of 2
+    double  getTraceSampleRate()        const;  // fraction of requests traced, 0 for none
+    bool    getTraceOnRequest()         const;  // honor trace=1, from loopback clients only
+    int     getTraceRequestRate()       const;  // max # of traces per minute asked for by trace=1
+    int     getTraceMaxFiles()          const;  // # of newest trace files kept in Traces/
+    int     getRelatedUsersLimit()      const;  // max # of related users on a profile page
+    int     getSnapshotInterval()       const;  // seconds between snapshots of the in-memory indexes
+    bool    getFAQGraph()               const;  // answer queries from memory, with a single process only
+    int     getGraphCheckInterval()     const;  // seconds between checks of the graph against the database, 0 for none
+    int     getGraphCheckSample()       const;  // # of classes, and of users, compared per check
+    int     getEventBlockSize()         const;  // max # of history events per block of the event log
+    int     getEventFlushInterval()     const;  // max ms a history event waits for its block
+    int     getEventRetentionDays()     const;  // days of history kept as events, older ones are rolled up
+    QString getDBSynchronous()          const;  // sqlite synchronous: off, normal (safe with WAL) or full
+    int     getDBCacheSize()            const;  // KiB of page cache per connection
+    qint64  getDBMmapSize()             const;  // bytes of the database file memory mapped, 0 for none
+
+    // admission control, per action
+    int getMaxConcurrent(const QString& action) const;  // max # of running requests
+    int getQueueDepth   (const QString& action) const;  // max # of requests waiting to run
+    int getPriority     (const QString& action) const;  // thread pool priority, higher runs first
 
     void setServerIP            (const QString& ip);
     void setServerPort          (uint port);
     void setSimilarityThreshold (double threshold);
+    void setWorkerThreads       (int count);
+    void setProcesses           (int count);
+    void setDurability          (const QString& mode);
+    void setWriteQueueCapacity  (int capacity);
+    void setWriteBatchSize      (int size);
+    void setWriteFlushInterval  (int ms);
+    void setStaticCacheSize     (qint64 bytes);
+    void setStaticMaxAge        (int seconds);
+    void setStaticStreamThreshold(qint64 bytes);
+    void setResponseCacheSize   (qint64 bytes);
+    void setCompressionThreshold(int bytes);
+    void setPhotoMaxSize        (qint64 bytes);
+    void setMaxBodySize         (qint64 bytes);
+    void setLogLevel            (const QString& level);
+    void setLogFile             (const QString& filePath);
+    void setLogSampleRate       (int rate);
+    void setLogBufferSize       (int records);
+    void setTraceSampleRate     (double rate);
+    void setTraceOnRequest      (bool enabled);
+    void setTraceRequestRate    (int perMinute);
+    void setTraceMaxFiles       (int count);
+    void setRelatedUsersLimit   (int count);
+    void setSnapshotInterval    (int seconds);
+    void setFAQGraph            (bool enabled);
+    void setGraphCheckInterval  (int seconds);
+    void setGraphCheckSample    (int size);
+    void setEventBlockSize      (int events);
+    void setEventFlushInterval  (int ms);
+    void setEventRetentionDays  (int days);
+    void setDBSynchronous       (const QString& mode);
+    void setDBCacheSize         (int kib);
+    void setDBMmapSize          (qint64 bytes);
+    void setAdmission(const QString& action, int maxConcurrent, int queueDepth, int priority);
 
 private:
     Settings();
     void loadDefaults();
-
-private:
-    static Settings* _instance;
 };
 
 #endif // SETTINGS_H
@@ -0,0 +1,77 @@
+﻿#include "SignalHandler.h"
+#include "Logger.h"
+
+#include <QSocketNotifier>
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+int SignalHandler::_pipe[2] = {-1, -1};
+
+SignalHandler::SignalHandler(QObject* parent)
+    : QObject(parent), _notifier(0)
+{
+#ifdef Q_OS_UNIX
+    if(_pipe[0] < 0)
+    {
+        if(::pipe(_pipe) != 0)   // e.g., out of file descriptors
+        {
+            _pipe[0] = _pipe[1] = -1;
+            LOG_ERROR("signal", tr("failed to create the signal pipe: %1").arg(QString::fromLocal8Bit(::strerror(errno))));
+            return;
+        }
+        ::fcntl(_pipe[1], F_SETFL, O_NONBLOCK);   // never block inside the handler
+        ::fcntl(_pipe[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(_pipe[1], F_SETFD, FD_CLOEXEC);
+    }
+    _notifier = new QSocketNotifier(_pipe[0], QSocketNotifier::Read, this);
+    connect(_notifier, SIGNAL(activated(int)), this, SLOT(onPipeReadable()));
+#endif
+}
+
+/**
+ * Start watching a signal, e.g., SIGTERM
+ * Without the pipe the signal keeps its default action, rather than being swallowed
+ */
+void SignalHandler::watch(int sig)
+{
+#ifdef Q_OS_UNIX
+    if(_pipe[1] < 0)
+        return;
+    struct sigaction action;
+    action.sa_handler = SignalHandler::handle;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    ::sigaction(sig, &action, 0);
+#else
+    Q_UNUSED(sig);
+#endif
+}
+
+/**
+ * The actual signal handler, async-signal-safe
+ */
+void SignalHandler::handle(int sig)
+{
+#ifdef Q_OS_UNIX
+    unsigned char byte = static_cast<unsigned char>(sig);
+    ssize_t written = ::write(_pipe[1], &byte, 1);
+    Q_UNUSED(written);
+#else
+    Q_UNUSED(sig);
+#endif
+}
+
+void SignalHandler::onPipeReadable()
+{
+#ifdef Q_OS_UNIX
+    unsigned char byte;
+    if(::read(_pipe[0], &byte, 1) == 1)
+        emit signalReceived(byte);
+#endif
+}
@@ -0,0 +1,34 @@
+﻿#ifndef SIGNALHANDLER_H
+#define SIGNALHANDLER_H
+
+#include <QObject>
+
+class QSocketNotifier;
+
+// Turns Unix signals into a Qt signal
+// A signal handler can hardly do anything safely, so it only writes the signal number
+// to a pipe, which is read on the event loop (the self-pipe trick)
+// On other platforms, or if the pipe can't be created, watch() does nothing
+class SignalHandler : public QObject
+{
+    Q_OBJECT
+
+public:
+    SignalHandler(QObject* parent = 0);
+    void watch(int sig);
+
+signals:
+    void signalReceived(int sig);
+
+private slots:
+    void onPipeReadable();
+
+private:
+    static void handle(int sig);
+
+private:
+    static int       _pipe[2];
+    QSocketNotifier* _notifier;
+};
+
+#endif // SIGNALHANDLER_H
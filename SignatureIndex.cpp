@@ -0,0 +1,123 @@
+﻿#include "SignatureIndex.h"
+
+SignatureIndex::SignatureIndex()
+    : _root(new Node),
+      _watermark(-1),
+      _loaded(false)
+{}
+
+SignatureIndex::~SignatureIndex() {
+    delete _root;
+}
+
+/**
+ * Fold the ASCII letters to lowercase, as LIKE does, other chars are left as they are
+ */
+QString SignatureIndex::fold(const QString& signature)
+{
+    QString result = signature;
+    for(int i = 0; i < result.length(); ++i)
+        if(result[i] >= 'A' && result[i] <= 'Z')
+            result[i] = QChar(result[i].unicode() + ('a' - 'A'));
+    return result;
+}
+
+void SignatureIndex::insert(int id, const QString& signature)
+{
+    QString key = fold(signature);
+    QWriteLocker locker(&_lock);
+    if(_signatures.contains(id))
+        return;
+    _signatures.insert(id, signature);
+
+    Node* node = _root;
+    int   pos  = 0;
+    while(pos < key.length())
+    {
+        Node* child = node->children.value(key[pos]);
+        if(child == 0)   // no edge starts with this char: the rest of the key becomes a leaf
+        {
+            child = new Node;
+            child->label = key.mid(pos);
+            node->children.insert(key[pos], child);
+            node = child;
+            break;
+        }
+
+        // length of the common prefix of the edge and the rest of the key
+        int common = 1;
+        while(common < child->label.length() && pos + common < key.length() &&
+              child->label[common] == key[pos + common])
+            ++common;
+
+        if(common < child->label.length())   // the key leaves the edge halfway: split the edge
+        {
+            Node* middle = new Node;
+            middle->label = child->label.left(common);
+            child->label.remove(0, common);
+            middle->children.insert(child->label[0], child);
+            node->children.insert(key[pos], middle);
+            child = middle;
+        }
+        node = child;
+        pos += common;
+    }
+    node->ids << id;
+}
+
+QMap<int, QString> SignatureIndex::find(const QString& prefix) const
+{
+    QString key = fold(prefix);
+    QReadLocker locker(&_lock);
+    QMap<int, QString> result;
+
+    // walk down the edges, the prefix may end halfway along an edge
+    const Node* node = _root;
+    int pos = 0;
+    while(pos < key.length())
+    {
+        const Node* child = node->children.value(key[pos]);
+        if(child == 0)
+            return result;
+        int length = qMin(child->label.length(), key.length() - pos);
+        if(child->label.leftRef(length) != key.midRef(pos, length))
+            return result;
+        node = child;
+        pos += length;
+    }
+
+    collect(node, result);   // every signature under the node starts with the prefix
+    return result;
+}
+
+void SignatureIndex::collect(const Node* node, QMap<int, QString>& result) const
+{
+    foreach(int id, node->ids)
+        result.insert(id, _signatures.value(id));
+    foreach(const Node* child, node->children)
+        collect(child, result);
+}
+
+qint64 SignatureIndex::getWatermark() const
+{
+    QReadLocker locker(&_lock);
+    return _watermark;
+}
+
+void SignatureIndex::setWatermark(qint64 watermark)
+{
+    QWriteLocker locker(&_lock);
+    _watermark = qMax(_watermark, watermark);
+}
+
+bool SignatureIndex::isLoaded() const
+{
+    QReadLocker locker(&_lock);
+    return _loaded;
+}
+
+void SignatureIndex::setLoaded()
+{
+    QWriteLocker locker(&_lock);
+    _loaded = true;
+}
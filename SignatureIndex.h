@@ -0,0 +1,58 @@
+﻿#ifndef SIGNATUREINDEX_H
+#define SIGNATUREINDEX_H
+
+#include <QString>
+#include <QHash>
+#include <QMap>
+#include <QReadWriteLock>
+
+// In-memory prefix index of the API signatures, i.e., lib;package.class.method
+// A radix tree, whose edges are labeled by runs of chars, so a class signature is resolved
+// to its APIs in O(length of the signature + number of APIs found).
+// Like SQLite's LIKE, it ignores the case of ASCII letters.
+// APIs are never changed or deleted, so the index only grows: DAO adds what it inserts,
+// and catches up on what other processes inserted, i.e., the rows above getWatermark().
+// The watermark is a rowid of APIs, not an ID: IDs are handed out by each process ahead of
+// the insert, so a lower ID may commit after a higher one, while rowids grow in commit order
+// Thread safe
+class SignatureIndex
+{
+public:
+    SignatureIndex();
+    ~SignatureIndex();
+
+    void insert(int id, const QString& signature);   // ignored if id is indexed already
+
+    // the APIs whose signature starts with prefix, ID -> signature
+    QMap<int, QString> find(const QString& prefix) const;
+
+    // rowid of the last row of APIs the index has caught up to, -1 for none
+    qint64 getWatermark() const;
+    void   setWatermark(qint64 watermark);   // never lowered, the loader and the readers race
+
+    static QString fold(const QString& signature);   // ASCII lowercase, the key of a signature
+
+    // the index is usable after the initial load of the APIs table
+    bool isLoaded() const;
+    void setLoaded();
+
+private:
+    struct Node
+    {
+        QString             label;      // chars on the edge into this node, folded
+        QList<int>          ids;        // APIs whose signature ends here
+        QHash<QChar, Node*> children;   // first char of the child's label -> child
+        ~Node() { qDeleteAll(children); }
+    };
+
+    void collect(const Node* node, QMap<int, QString>& result) const;
+
+private:
+    mutable QReadWriteLock _lock;
+    Node*                  _root;
+    QHash<int, QString>    _signatures;   // ID -> original signature
+    qint64                 _watermark;
+    bool                   _loaded;
+};
+
+#endif // SIGNATUREINDEX_H
@@ -14,6 +14,8 @@ class SimilarityComparer : public QObject
 
 public:
     SimilarityComparer(QObject* parent = 0);
+
+public slots:
     void compare(const QString& leadQuestion, const QString& question);
 
 private slots:
@@ -1,12 +1,14 @@
 ﻿#include "SnippetCreator.h"
 #include "Template.h"
 #include "Settings.h"
+#include "Metrics.h"
+#include "Logger.h"
+#include "Tracer.h"
 
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QTextStream>
-#include <QDebug>
 
 //Examples:
 //Input:
@@ -34,6 +36,15 @@
 //            }]
 //}
 
+/**
+ * @return  - id of the render stage histogram
+ */
+int SnippetCreator::getRenderHistogram()
+{
+    static const int histogram = Metrics::getInstance()->getHistogram("faqs_stage_duration_seconds", "stage=\"render\"");
+    return histogram;
+}
+
 /**
  * Convert FAQs content into HTML
  * @param jaAPIs    - json array representing the content of the FAQs of an API
@@ -41,6 +52,8 @@
  */
 QJsonDocument SnippetCreator::createFAQs(const QJsonArray& jaAPIs) const
 {
+    TRACE_SPAN("createFAQs");
+    LatencyTimer timer(getRenderHistogram());
     QJsonObject joDocPage;
     Settings* settings = Settings::getInstance();
 
@@ -64,8 +77,9 @@ QJsonDocument SnippetCreator::createFAQs(const QJsonArray& jaAPIs) const
 
     joDocPage.insert("apis", jaFAQs);
 
-    qDebug() << joDocPage;
-    return QJsonDocument(joDocPage);
+    QJsonDocument result(joDocPage);
+    LOG_PAYLOAD("snippet", QString(result.toJson(QJsonDocument::Compact)));
+    return result;
 }
 
 /**
@@ -75,6 +89,7 @@ QJsonDocument SnippetCreator::createFAQs(const QJsonArray& jaAPIs) const
  */
 QByteArray SnippetCreator::createFAQ(const QJsonObject& joAPI) const
 {
+    TRACE_SPAN("createFAQ");
     Template tTitle("./Templates/FAQ.html");
     tTitle.setValue("Questions", createQuestions(joAPI));
     return tTitle.toHTML();
@@ -117,6 +132,7 @@ QByteArray SnippetCreator::createFAQ(const QJsonObject& joAPI) const
  */
 QByteArray SnippetCreator::createQuestions(const QJsonObject& joAPI) const
 {
+    TRACE_SPAN("createQuestions");
     QJsonArray jaQuestions = joAPI.value("questions").toArray();
     Template tQuestions("./Templates/Questions.html");
 
@@ -173,6 +189,8 @@ QByteArray SnippetCreator::createQuestions(const QJsonObject& joAPI) const
  */
 QByteArray SnippetCreator::createProfilePage(const QJsonObject& joProfile) const
 {
+    TRACE_SPAN("createProfilePage");
+    LatencyTimer timer(getRenderHistogram());
     Template tProfilePage("./Templates/ProfilePage.html");
     if(!tProfilePage.isLoaded())
         return "Template not loaded!";
@@ -195,6 +213,7 @@ QByteArray SnippetCreator::createProfilePage(const QJsonObject& joProfile) const
  */
 QByteArray SnippetCreator::createProfileSection(const QJsonObject& joProfile) const
 {
+    TRACE_SPAN("createProfileSection");
     QString name  = joProfile.value("name") .toString();
     QString email = joProfile.value("email").toString();
     Template tProfile("./Templates/ProfileSection.html");
@@ -208,6 +227,7 @@ QByteArray SnippetCreator::createProfileSection(const QJsonObject& joProfile) co
  */
 QByteArray SnippetCreator::createInterestedAPIs(const QJsonObject& joProfile) const
 {
+    TRACE_SPAN("createInterestedAPIs");
     Template tAPIs("./Templates/InterestedAPIs.html");
     QJsonArray jaAPIs = joProfile.value("apis").toArray();
     for(QJsonArray::Iterator it = jaAPIs.begin(); it != jaAPIs.end(); ++it)
@@ -229,6 +249,7 @@ QByteArray SnippetCreator::createInterestedAPIs(const QJsonObject& joProfile) co
  */
 QByteArray SnippetCreator::createRelatedUsers(const QJsonObject& joProfile) const
 {
+    TRACE_SPAN("createRelatedUsers");
     Template tUsers("./Templates/RelatedUsers.html");
     QJsonArray jaUsers = joProfile.value("relatedusers").toArray();
     for(QJsonArray::Iterator it = jaUsers.begin(); it != jaUsers.end(); ++it)
@@ -16,6 +16,7 @@ public:
     QByteArray    createProfilePage(const QJsonObject& joProfile) const;
 
 private:
+    static int getRenderHistogram();
     QByteArray createFAQ           (const QJsonObject& joAPI)     const;
     QByteArray createQuestions     (const QJsonObject& joAPI)     const;
     QByteArray createProfileSection(const QJsonObject& joProfile) const;
@@ -0,0 +1,115 @@
+﻿#include "StaticCache.h"
+#include "Compressor.h"
+#include "Metrics.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QCryptographicHash>
+#include <QMimeDatabase>
+#include <climits>
+
+/**
+ * By extension, except for images, whose first bytes decide: a photo is saved as
+ * Photos/<user>.png, whether it's a PNG, a JPEG or a GIF
+ */
+static QString getMimeType(const QFileInfo& fileInfo)
+{
+    QMimeDatabase database;
+    QString byExtension = database.mimeTypeForFile(fileInfo, QMimeDatabase::MatchExtension).name();
+    if(!byExtension.startsWith("image/"))
+        return byExtension;
+    QString byContent = database.mimeTypeForFile(fileInfo, QMimeDatabase::MatchContent).name();
+    return byContent.startsWith("image/") ? byContent : byExtension;
+}
+
+StaticCache::StaticCache(qint64 capacity, QObject* parent)
+    : QObject(parent),
+      _cache(static_cast<int>(qMin<qint64>(capacity, INT_MAX)))
+{
+    _watcher = new QFileSystemWatcher(this);
+    connect(_watcher, SIGNAL(fileChanged(QString)), this, SLOT(onFileChanged(QString)));
+}
+
+/**
+ * Get a file, from the cache if possible
+ * @param filePath  - path of the file
+ * @param entry     - output, the content and metadata of the file
+ * @return          - false if the file does not exist or can't be read
+ */
+bool StaticCache::lookup(const QString& filePath, Entry& entry)
+{
+    static const int hits   = Metrics::getInstance()->getCounter("faqs_static_cache_hits_total");
+    static const int misses = Metrics::getInstance()->getCounter("faqs_static_cache_misses_total");
+
+    if(Entry* cached = _cache.object(filePath))
+    {
+        Metrics::getInstance()->add(hits);
+        entry = *cached;
+        return true;
+    }
+
+    Metrics::getInstance()->add(misses);
+
+    if(!load(filePath, entry))
+        return false;
+
+    // QCache refuses, and deletes, entries larger than the whole cache
+    int cost = qMax(entry.content.size() + entry.gzipped.size(), 1);
+    if(_cache.insert(filePath, new Entry(entry), cost))
+    {
+        _watcher->addPath(filePath);
+
+        // stop watching the files QCache has evicted to make room
+        foreach(const QString& watched, _watcher->files())
+            if(!_cache.contains(watched))
+                _watcher->removePath(watched);
+    }
+    return true;
+}
+
+/**
+ * Read a file from disk
+ */
+bool StaticCache::load(const QString& filePath, Entry& entry) const
+{
+    QFile file(filePath);
+    if(!file.open(QFile::ReadOnly))
+        return false;
+
+    entry.content      = file.readAll();
+    entry.eTag         = '"' + QCryptographicHash::hash(entry.content, QCryptographicHash::Md5).toHex() + '"';
+    entry.lastModified = QFileInfo(file).lastModified().toUTC();
+    entry.mimeType     = getMimeType(QFileInfo(file));
+
+    if(Compressor::isCompressible(entry.mimeType))
+    {
+        entry.gzipped = Compressor::gzip(entry.content);
+        if(entry.gzipped.size() >= entry.content.size())   // not worth it
+            entry.gzipped.clear();
+    }
+    return true;
+}
+
+/**
+ * Describe a file without reading it
+ * The ETag is derived from the size and modification time instead of the content
+ */
+StaticCache::Entry StaticCache::describe(const QFileInfo& fileInfo)
+{
+    Entry entry;
+    entry.lastModified = fileInfo.lastModified().toUTC();
+    entry.eTag         = '"' + QByteArray::number(fileInfo.size(), 16) + '-'
+                             + QByteArray::number(entry.lastModified.toMSecsSinceEpoch(), 16) + '"';
+    entry.mimeType     = getMimeType(fileInfo);
+    return entry;
+}
+
+/**
+ * A cached file has been modified, renamed or removed
+ */
+void StaticCache::onFileChanged(const QString& filePath)
+{
+    _cache.remove(filePath);
+    _watcher->removePath(filePath);   // re-added when the file is loaded again
+}
@@ -0,0 +1,47 @@
+﻿#ifndef STATICCACHE_H
+#define STATICCACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QDateTime>
+
+class QFileSystemWatcher;
+class QFileInfo;
+
+// An in-memory cache of static files (style sheets, photos), keyed by path
+// The total size is bounded, least recently used files are evicted first
+// Cached files are watched, and dropped from the cache once they change on disk
+// Text files are kept gzipped too, so that they are compressed once, not per request
+class StaticCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Entry
+    {
+        QByteArray content;
+        QByteArray gzipped;        // precompressed content, empty if not compressible
+        QByteArray eTag;           // strong validator, a quoted hash of the content
+        QDateTime  lastModified;
+        QString    mimeType;
+    };
+
+public:
+    StaticCache(qint64 capacity, QObject* parent = 0);
+    bool lookup(const QString& filePath, Entry& entry);   // false if the file can't be read
+
+    // metadata of a file that is too large to cache, without the content
+    static Entry describe(const QFileInfo& fileInfo);
+
+private slots:
+    void onFileChanged(const QString& filePath);
+
+private:
+    bool load(const QString& filePath, Entry& entry) const;
+
+private:
+    QCache<QString, Entry> _cache;     // file path -> content, cost is the size in bytes
+    QFileSystemWatcher*    _watcher;   // inotify on Linux
+};
+
+#endif // STATICCACHE_H
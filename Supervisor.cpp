@@ -0,0 +1,266 @@
+﻿#include "Supervisor.h"
+
+#include <QtGlobal>
+#include <cstdio>
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/wait.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/prctl.h>
+#endif
+
+volatile int Supervisor::_restart     = 0;
+volatile int Supervisor::_stop        = 0;
+volatile int Supervisor::_childExited = 0;
+
+Supervisor::Supervisor(int processes)
+    : _processes(processes), _worker(-1), _generation(0), _readyFD(-1) {}
+
+void Supervisor::handle(int sig)
+{
+#ifdef Q_OS_UNIX
+    if(sig == SIGHUP)
+        _restart = 1;
+    else if(sig == SIGCHLD)
+        _childExited = 1;
+    else
+        _stop = 1;
+#else
+    Q_UNUSED(sig);
+#endif
+}
+
+/**
+ * Fork the workers and supervise them
+ * No logger here: it runs a thread, which a forked child would not have.
+ * The supervisor reports to stderr
+ * @return  - true in a worker, false in the supervisor when it is done
+ */
+bool Supervisor::run()
+{
+#ifdef Q_OS_UNIX
+    if(_processes < 2)
+        return true;
+
+    // the signals are only let in while the supervisor waits in sigsuspend(), so no flag is missed
+    sigset_t watched, original;
+    sigemptyset(&watched);
+    int signals[] = {SIGHUP, SIGCHLD, SIGTERM, SIGINT};
+    for(int i = 0; i < 4; ++i)
+    {
+        struct sigaction action;
+        action.sa_handler = Supervisor::handle;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = 0;
+        ::sigaction(signals[i], &action, 0);
+        sigaddset(&watched, signals[i]);
+    }
+    sigprocmask(SIG_BLOCK, &watched, &original);
+
+    if(!spawnGeneration())
+        return true;
+
+    for(;;)
+    {
+        sigsuspend(&original);
+
+        if(_childExited)
+        {
+            _childExited = 0;
+            reap();
+
+            // replace the dead workers of the current generation
+            if(!_stop)
+                for(int index = 0; index < _processes; ++index)
+                {
+                    bool alive = false;
+                    foreach(const Worker& worker, _workers)
+                        if(worker.index == index && worker.generation == _generation)
+                            alive = true;
+                    if(!alive)
+                    {
+                        fprintf(stderr, "Supervisor: worker %d died, restarting it\n", index);
+                        sleep(1);   // don't spin if it dies right away
+                        if(!spawn(index, -1))
+                            return true;
+                    }
+                }
+        }
+
+        if(_stop)
+        {
+            terminate(-1);
+            while(!_workers.isEmpty())
+            {
+                int status;
+                int pid = ::waitpid(-1, &status, 0);
+                if(pid < 0 && errno != EINTR)
+                    break;
+                for(int i = 0; i < _workers.size(); ++i)
+                    if(_workers[i].pid == pid)
+                        _workers.removeAt(i--);
+            }
+            return false;
+        }
+
+        if(_restart)
+        {
+            _restart = 0;
+            int old = _generation++;
+            fprintf(stderr, "Supervisor: restarting, generation %d\n", _generation);
+            if(!spawnGeneration())
+                return true;
+            terminate(old);   // the new generation listens already, nothing is refused meanwhile
+        }
+    }
+#else
+    return true;
+#endif
+}
+
+/**
+ * Fork a full set of workers, and wait until they all listen
+ */
+bool Supervisor::spawnGeneration()
+{
+#ifdef Q_OS_UNIX
+    int ready[2];
+    if(::pipe(ready) != 0)
+        ready[0] = ready[1] = -1;
+
+    for(int index = 0; index < _processes; ++index)
+        if(!spawn(index, ready[1]))
+        {
+            if(ready[0] >= 0)
+                ::close(ready[0]);
+            return false;
+        }
+
+    if(ready[1] >= 0)
+        ::close(ready[1]);
+    waitReady(ready[0], _processes);
+    if(ready[0] >= 0)
+        ::close(ready[0]);
+#endif
+    return true;
+}
+
+/**
+ * Fork one worker
+ * @param readyFD   - the worker writes a byte to it once it listens, -1 if nobody waits for that
+ * @return          - false in the child
+ */
+bool Supervisor::spawn(int index, int readyFD)
+{
+#ifdef Q_OS_UNIX
+    int pid = ::fork();
+    if(pid == 0)
+    {
+        // the worker handles its own signals, see SignalHandler
+        int signals[] = {SIGHUP, SIGCHLD, SIGTERM, SIGINT};
+        sigset_t all;
+        sigemptyset(&all);
+        for(int i = 0; i < 4; ++i)
+        {
+            ::signal(signals[i], SIG_DFL);
+            sigaddset(&all, signals[i]);
+        }
+        ::signal(SIGHUP, SIG_IGN);   // restarts are the supervisor's business
+        sigprocmask(SIG_UNBLOCK, &all, 0);
+#ifdef Q_OS_LINUX
+        ::prctl(PR_SET_PDEATHSIG, SIGTERM);   // don't outlive the supervisor
+#endif
+        _worker  = index;
+        _readyFD = readyFD;
+        _workers.clear();
+        return false;
+    }
+    if(pid < 0)
+    {
+        fprintf(stderr, "Supervisor: can not fork worker %d\n", index);
+        return true;
+    }
+
+    Worker worker;
+    worker.pid        = pid;
+    worker.index      = index;
+    worker.generation = _generation;
+    _workers << worker;
+#else
+    Q_UNUSED(index);
+    Q_UNUSED(readyFD);
+#endif
+    return true;
+}
+
+/**
+ * Block until count workers have reported, or they take too long (e.g., some died)
+ */
+void Supervisor::waitReady(int readyFD, int count)
+{
+#ifdef Q_OS_UNIX
+    if(readyFD < 0)
+        return;
+    struct pollfd fd;
+    fd.fd     = readyFD;
+    fd.events = POLLIN;
+    while(count > 0 && ::poll(&fd, 1, 10000) > 0)
+    {
+        char buffer[64];
+        ssize_t length = ::read(readyFD, buffer, sizeof(buffer));
+        if(length <= 0)   // all write ends closed, i.e., the workers died
+            break;
+        count -= length;
+    }
+#else
+    Q_UNUSED(readyFD);
+    Q_UNUSED(count);
+#endif
+}
+
+/**
+ * Forget the workers that have exited
+ */
+void Supervisor::reap()
+{
+#ifdef Q_OS_UNIX
+    int status;
+    int pid;
+    while((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+        for(int i = 0; i < _workers.size(); ++i)
+            if(_workers[i].pid == pid)
+                _workers.removeAt(i--);
+#endif
+}
+
+void Supervisor::terminate(int generation)
+{
+#ifdef Q_OS_UNIX
+    foreach(const Worker& worker, _workers)
+        if(generation < 0 || worker.generation == generation)
+            ::kill(worker.pid, SIGTERM);
+#else
+    Q_UNUSED(generation);
+#endif
+}
+
+/**
+ * Tell the supervisor this worker listens, so that it can retire the previous generation
+ */
+void Supervisor::notifyReady()
+{
+#ifdef Q_OS_UNIX
+    if(_readyFD < 0)
+        return;
+    char byte = 1;
+    ssize_t written = ::write(_readyFD, &byte, 1);
+    Q_UNUSED(written);
+    ::close(_readyFD);
+    _readyFD = -1;
+#endif
+}
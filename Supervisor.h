@@ -0,0 +1,54 @@
+﻿#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <QList>
+
+// Runs the server as several worker processes, which share the port with SO_REUSEPORT
+// so that the kernel balances connections between them
+// run() forks the workers, before Qt or any thread is started; it returns true in each worker,
+// which goes on to create its Server, and keeps the supervisor looping until it is told to stop:
+//  - a worker that dies is forked again
+//  - SIGHUP restarts gracefully: a new generation is forked, and once all of its workers
+//    listen, the old one gets SIGTERM, stops accepting, and finishes its requests
+//  - SIGTERM or SIGINT stops all workers
+// Worker 0 of each generation is the designated writer, see WriteReceiver.
+// Unix only, elsewhere run() returns true right away, for a single process
+class Supervisor
+{
+public:
+    Supervisor(int processes);
+    bool run();            // true in a worker, false in the supervisor once the workers are gone
+    void notifyReady();    // called by a worker once it listens
+
+    int getWorker()     const { return _worker;     }   // this worker's index, -1 if not supervised
+    int getGeneration() const { return _generation; }
+
+private:
+    struct Worker
+    {
+        int pid;
+        int index;
+        int generation;
+    };
+
+    bool spawnGeneration();                  // false in a child
+    bool spawn(int index, int readyFD);      // false in a child
+    void waitReady(int readyFD, int count);
+    void reap();
+    void terminate(int generation);          // SIGTERM all workers of a generation, -1 for all
+
+    static void handle(int sig);
+
+private:
+    int           _processes;
+    int           _worker;
+    int           _generation;
+    int           _readyFD;       // in a worker, written once it listens
+    QList<Worker> _workers;
+
+    static volatile int _restart;
+    static volatile int _stop;
+    static volatile int _childExited;
+};
+
+#endif // SUPERVISOR_H
@@ -1,10 +1,12 @@
 ﻿#include "Template.h"
+#include "Tracer.h"
 #include <QFile>
 #include <QRegExp>
 
 Template::Template(const QString& fileName)
     : _loaded(false)
 {
+    TRACE_SPAN_DETAIL("template load", fileName);
     QFile file(fileName);
     if(file.open(QFile::ReadOnly))
     {
@@ -30,7 +32,10 @@ void Template::setValue(const QString& attribute, const QString& value) {
     _html.replace("$" + attribute + "$", value);
 }
 
-QByteArray Template::toHTML() const {
+QByteArray Template::toHTML() const
+{
+    TRACE_SPAN("template render");
+
     // remove placeholders $XXX$
     return QString(_html).remove(QRegExp("\\$\\w+\\$")).toUtf8();
 }
@@ -0,0 +1,145 @@
+﻿#include "Tracer.h"
+#include "Settings.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QThread>
+#include <QHostAddress>
+#include <QFileInfo>
+#include <qmath.h>
+
+Tracer* Tracer::getInstance()
+{
+    static Tracer* instance = new Tracer;
+    return instance;
+}
+
+Tracer::Tracer()
+{
+    _clock.start();
+    double rate = Settings::getInstance()->getTraceSampleRate();
+    _sampleInterval = rate > 0 ? qMax(qRound(1.0 / qMin(rate, 1.0)), 1) : 0;
+    _onRequest   = Settings::getInstance()->getTraceOnRequest();
+    _requestRate = Settings::getInstance()->getTraceRequestRate();
+    _maxFiles    = Settings::getInstance()->getTraceMaxFiles();
+    _windowStart = 0;
+    _requested   = 0;
+}
+
+bool Tracer::shouldSample() {
+    return _sampleInterval > 0 && _requests.fetchAndAddRelaxed(1) % _sampleInterval == 0;
+}
+
+/**
+ * A trace costs a file, so only the operator asks for one: trace=1 is honored if enabled,
+ * from the machine itself, and at most TraceRequestRate times a minute
+ */
+bool Tracer::allowRequested(const QHostAddress& client)
+{
+    if(!_onRequest)
+        return false;
+
+    bool isIPv4;
+    quint32 ipv4 = client.toIPv4Address(&isIPv4);   // an IPv4-mapped IPv6 address too
+    if(!(isIPv4 ? QHostAddress(ipv4).isLoopback() : client.isLoopback()))
+        return false;
+
+    QMutexLocker locker(&_requestedMutex);
+    qint64 now = _clock.elapsed();
+    if(now - _windowStart >= 60 * 1000)
+    {
+        _windowStart = now;
+        _requested   = 0;
+    }
+    if(_requested >= _requestRate)
+        return false;
+    ++ _requested;
+    return true;
+}
+
+bool Tracer::isTracing() {
+    return _traces.hasLocalData() && _traces.localData() != 0;
+}
+
+void Tracer::begin(const QString& name)
+{
+    Trace* trace = new Trace;
+    trace->name = name;
+    _traces.setLocalData(trace);   // deletes the previous one, if any
+}
+
+void Tracer::addSpan(const char* name, qint64 start, qint64 duration, const QString& detail)
+{
+    if(!isTracing())
+        return;
+    Span span;
+    span.name     = name;
+    span.start    = start;
+    span.duration = duration;
+    span.detail   = detail;
+    _traces.localData()->spans << span;
+}
+
+/**
+ * Write the current thread's trace to Traces/<time>-<name>-<n>.json, and end it
+ * @return  - name of the file, or an empty string if there is no trace or it can't be written
+ */
+QString Tracer::end()
+{
+    if(!isTracing())
+        return QString();
+
+    Trace* trace = _traces.localData();
+    qint64 pid = QCoreApplication::applicationPid();
+    qint64 tid = reinterpret_cast<quintptr>(QThread::currentThreadId());
+
+    // complete events, "ph": "X", times in us
+    QJsonArray jaEvents;
+    foreach(const Span& span, trace->spans)
+    {
+        QJsonObject joEvent;
+        joEvent.insert("name", QString(span.name));
+        joEvent.insert("cat",  trace->name);
+        joEvent.insert("ph",   QString("X"));
+        joEvent.insert("ts",   static_cast<double>(span.start));
+        joEvent.insert("dur",  static_cast<double>(span.duration));
+        joEvent.insert("pid",  static_cast<double>(pid));
+        joEvent.insert("tid",  static_cast<double>(tid));
+        if(!span.detail.isEmpty())
+        {
+            QJsonObject joArgs;
+            joArgs.insert("detail", span.detail);
+            joEvent.insert("args", joArgs);
+        }
+        jaEvents.append(joEvent);
+    }
+    QJsonObject joTrace;
+    joTrace.insert("traceEvents", jaEvents);
+
+    QString fileName = QString("%1-%2-%3.json")
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"))
+            .arg(trace->name)
+            .arg(_exported.fetchAndAddRelaxed(1));
+    _traces.setLocalData(0);
+
+    QDir().mkpath("Traces");
+    QFile file("Traces/" + fileName);
+    if(!file.open(QFile::WriteOnly))
+        return QString();
+    file.write(QJsonDocument(joTrace).toJson(QJsonDocument::Compact));
+    file.close();
+    prune();
+    return fileName;
+}
+
+void Tracer::prune()
+{
+    QFileInfoList files = QDir("Traces").entryInfoList(QStringList("*.json"), QDir::Files, QDir::Time);   // newest first
+    for(int i = _maxFiles; i < files.size(); ++i)
+        QFile::remove(files[i].filePath());
+}
@@ -0,0 +1,90 @@
+﻿#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <QVector>
+#include <QThreadStorage>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QMutex>
+
+class QHostAddress;
+
+// Per-request tracing, exported as Chrome trace-event JSON (open in chrome://tracing or Perfetto)
+// A sampled request begins a trace on the worker thread that runs it, scoped spans (TRACE_SPAN)
+// on that thread are collected into it, and the trace is written to Traces/ when the request ends.
+// On threads without a trace, a span costs one thread-local lookup, and its detail is not evaluated
+// A client may ask for a trace with trace=1 if TraceOnRequest is set, from loopback only, and
+// TraceRequestRate times a minute at most. Traces/ keeps the newest TraceMaxFiles traces
+class Tracer
+{
+public:
+    static Tracer* getInstance();
+
+    bool    shouldSample();                   // per request decision, by TraceSampleRate
+    bool    allowRequested(const QHostAddress& client);   // may this client's trace=1 be honored
+    void    begin(const QString& name);       // start a trace on the current thread
+    QString end();                            // write the current thread's trace, returns its file name
+    bool    isTracing();                      // the current thread has a trace
+    qint64  now() const { return _clock.nsecsElapsed() / 1000; }   // us
+    void    addSpan(const char* name, qint64 start, qint64 duration, const QString& detail = QString());
+
+private:
+    struct Span
+    {
+        const char* name;       // a string literal
+        qint64      start;      // us
+        qint64      duration;   // us
+        QString     detail;     // e.g., the SQL statement
+    };
+
+    struct Trace
+    {
+        QString       name;
+        QVector<Span> spans;
+    };
+
+private:
+    Tracer();
+    void prune();   // remove the oldest trace files beyond TraceMaxFiles
+
+private:
+    QThreadStorage<Trace*> _traces;    // trace of each thread, null if the thread is not tracing
+    QElapsedTimer          _clock;     // timestamps of all traces
+    QAtomicInt             _requests;  // for sampling
+    QAtomicInt             _exported;  // for unique file names
+    int                    _sampleInterval;   // trace 1 in this many requests, 0 for none
+    bool                   _onRequest;        // honor trace=1
+    int                    _requestRate;      // max requested traces per minute
+    int                    _maxFiles;
+    QMutex                 _requestedMutex;
+    qint64                 _windowStart;      // ms on _clock, of the current minute of requested traces
+    int                    _requested;        // # of requested traces in the current minute
+};
+
+// Adds the lifetime of a scope to the current thread's trace, if any
+class TraceSpan
+{
+public:
+    TraceSpan(const char* name, const QString& detail = QString())
+        : _name(name),
+          _detail(detail),
+          _start(Tracer::getInstance()->isTracing() ? Tracer::getInstance()->now() : -1) {}
+
+    ~TraceSpan()
+    {
+        if(_start >= 0)
+            Tracer::getInstance()->addSpan(_name, _start, Tracer::getInstance()->now() - _start, _detail);
+    }
+
+private:
+    const char* _name;
+    QString     _detail;
+    qint64      _start;   // -1 if not tracing
+};
+
+#define TRACE_SPAN(name) TraceSpan traceSpan(name)
+#define TRACE_SPAN_DETAIL(name, detail) \
+    TraceSpan traceSpan(name, Tracer::getInstance()->isTracing() ? QString(detail) : QString())
+
+#endif // TRACER_H
@@ -0,0 +1,113 @@
+﻿#include "WriteBehindQueue.h"
+#include "DAO.h"
+#include "Settings.h"
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <QMutexLocker>
+
+WriteBehindQueue* WriteBehindQueue::getInstance()
+{
+    static WriteBehindQueue* instance = new WriteBehindQueue;
+    return instance;
+}
+
+WriteBehindQueue::WriteBehindQueue()
+    : _stopping(false)
+{
+    Settings* settings = Settings::getInstance();
+    _capacity      = settings->getWriteQueueCapacity();
+    _batchSize     = settings->getWriteBatchSize();
+    _flushInterval = settings->getWriteFlushInterval();
+    start();
+}
+
+/**
+ * Add an event to the queue, the caller can acknowledge the request right away
+ * @return  - false if the queue is full or the writer is stopping
+ */
+bool WriteBehindQueue::enqueue(const WriteEvent& event)
+{
+    QMutexLocker locker(&_mutex);
+    if(_stopping || _queue.size() >= _capacity)
+        return false;
+
+    _queue.enqueue(event);
+
+    // the writer is idle on an empty queue, or waiting for the batch to fill
+    if(_queue.size() == 1 || _queue.size() >= _batchSize)
+        _wakeUp.wakeOne();
+    return true;
+}
+
+/**
+ * Stop accepting events, and block until all the queued ones are written
+ */
+void WriteBehindQueue::stop()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stopping = true;
+        _wakeUp.wakeOne();
+    }
+    wait();
+}
+
+/**
+ * The writer thread
+ */
+void WriteBehindQueue::run()
+{
+    forever
+    {
+        QList<WriteEvent> batch;
+        {
+            QMutexLocker locker(&_mutex);
+            if(_queue.isEmpty() && !_stopping)
+                _wakeUp.wait(&_mutex);
+
+            // give the batch some time to fill, unless we are shutting down
+            if(!_queue.isEmpty() && _queue.size() < _batchSize && !_stopping)
+                _wakeUp.wait(&_mutex, _flushInterval);
+
+            while(!_queue.isEmpty() && batch.size() < _batchSize)
+                batch << _queue.dequeue();
+
+            if(batch.isEmpty() && _stopping)   // drained
+                break;
+        }
+        flush(batch);
+    }
+
+    DAO::getInstance()->closeDatabase();
+}
+
+/**
+ * Write a batch of events in one transaction
+ */
+void WriteBehindQueue::flush(const QList<WriteEvent>& batch)
+{
+    if(batch.isEmpty())
+        return;
+
+    static const int histogram = Metrics::getInstance()->getHistogram("faqs_stage_duration_seconds", "stage=\"flush\"");
+    LatencyTimer timer(histogram);
+
+    DAO* dao = DAO::getInstance();
+    if(dao->beginTransaction())
+    {
+        foreach(const WriteEvent& event, batch)
+            dao->apply(event);
+        if(dao->commit())
+            return;
+        dao->rollback();   // nothing of the batch is saved
+    }
+
+    // the batch failed as a whole, or could not start, retry the events one by one
+    // so that one bad event does not take the others down with it
+    // each apply() is a transaction of its own, nothing is applied twice
+    LOG_WARNING("writer", QString("batch failed events=%1, retrying individually").arg(batch.size()));
+    foreach(const WriteEvent& event, batch)
+        if(!dao->apply(event))
+            LOG_ERROR("writer", QString("dropped event user=%1 type=%2").arg(event.userName).arg(event.type));
+}
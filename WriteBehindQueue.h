@@ -0,0 +1,41 @@
+﻿#ifndef WRITEBEHINDQUEUE_H
+#define WRITEBEHINDQUEUE_H
+
+#include "WriteEvent.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+
+// A bounded queue of write events, drained by a dedicated writer thread
+// The writer commits the events in batches, one transaction per batch, so that
+// many plugin events share one journal sync.
+// A batch is flushed when it is full, or when its first event has waited long enough
+class WriteBehindQueue : public QThread
+{
+public:
+    static WriteBehindQueue* getInstance();
+
+    bool enqueue(const WriteEvent& event);   // false if the queue is full
+    void stop();                             // write all pending events and end the writer
+
+protected:
+    void run();
+
+private:
+    WriteBehindQueue();
+    void flush(const QList<WriteEvent>& batch);
+
+private:
+    QMutex              _mutex;     // guards _queue and _stopping
+    QWaitCondition      _wakeUp;    // signaled when the writer has work to do
+    QQueue<WriteEvent>  _queue;
+    bool                _stopping;
+
+    int _capacity;        // max # of queued events
+    int _batchSize;       // max # of events per transaction
+    int _flushInterval;   // max time (ms) an event waits for its batch to fill
+};
+
+#endif // WRITEBEHINDQUEUE_H
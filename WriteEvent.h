@@ -0,0 +1,37 @@
+﻿#ifndef WRITEEVENT_H
+#define WRITEEVENT_H
+
+#include <QString>
+#include <QDataStream>
+
+// A write request from the IDE plugin: save, logapi or loganswer
+// Carries everything DAO needs to apply it later, possibly on another thread
+struct WriteEvent
+{
+    enum Type {Save, LogDocumentReading, LogAnswerClicking};
+
+    Type    type;
+    QString userName;
+    QString email;
+    QString apiSig;     // Save, LogDocumentReading
+    QString question;   // Save
+    QString link;       // Save, LogAnswerClicking
+    QString title;      // Save
+};
+
+// for forwarding events to the writer process
+inline QDataStream& operator<<(QDataStream& out, const WriteEvent& event)
+{
+    return out << static_cast<qint32>(event.type) << event.userName << event.email
+               << event.apiSig << event.question << event.link << event.title;
+}
+
+inline QDataStream& operator>>(QDataStream& in, WriteEvent& event)
+{
+    qint32 type;
+    in >> type >> event.userName >> event.email >> event.apiSig >> event.question >> event.link >> event.title;
+    event.type = static_cast<WriteEvent::Type>(type);
+    return in;
+}
+
+#endif // WRITEEVENT_H
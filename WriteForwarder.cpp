@@ -0,0 +1,106 @@
+﻿#include "WriteForwarder.h"
+#include "Logger.h"
+
+#include <QLocalSocket>
+#include <QDataStream>
+#include <QMutexLocker>
+
+static const int MaxBacklog = 1024 * 1024;   // bytes the writer may leave unread before events are turned away
+
+WriteForwarder::WriteForwarder(const QString& serverName, int capacity, QObject* parent)
+    : QObject(parent), _serverName(serverName), _capacity(capacity)
+{
+    _socket = new QLocalSocket(this);
+    connect(_socket, SIGNAL(connected()),    this, SLOT(onConnected()));
+    connect(_socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+    connect(_socket, SIGNAL(bytesWritten(qint64)), this, SLOT(onBytesWritten()));
+    connectToWriter();
+}
+
+/**
+ * Queue an event for the writer, called from any thread
+ */
+bool WriteForwarder::forward(const WriteEvent& event)
+{
+    if(!_connected.load())
+    {
+        QMetaObject::invokeMethod(this, "connectToWriter", Qt::QueuedConnection);
+        return false;
+    }
+
+    QMutexLocker locker(&_mutex);
+    if(_pending.size() >= _capacity || _backlog.load() >= MaxBacklog)
+        return false;
+    _pending << event;
+    if(_pending.size() == 1)   // the first one schedules the send, the rest ride along
+        QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+    return true;
+}
+
+void WriteForwarder::flush()
+{
+    QList<WriteEvent> events;
+    {
+        QMutexLocker locker(&_mutex);
+        events.swap(_pending);
+    }
+    if(events.isEmpty())
+        return;
+
+    QDataStream out(_socket);
+    out.setVersion(QDataStream::Qt_5_0);
+    foreach(const WriteEvent& event, events)
+        out << event;
+    _socket->flush();
+    onBytesWritten();
+}
+
+/**
+ * On shutdown: the process may exit as soon as this returns, with the socket's buffer
+ */
+bool WriteForwarder::drain(int timeout)
+{
+    flush();
+    QElapsedTimer timer;
+    timer.start();
+    while(_socket->bytesToWrite() > 0)
+    {
+        int remaining = timeout - static_cast<int>(timer.elapsed());
+        if(remaining <= 0 || !_socket->waitForBytesWritten(remaining))
+        {
+            LOG_ERROR("forwarder", tr("unsent to writer=%1 bytes=%2").arg(_serverName).arg(_socket->bytesToWrite()));
+            return false;
+        }
+    }
+    return true;
+}
+
+void WriteForwarder::onBytesWritten() {
+    _backlog.store(static_cast<int>(qMin<qint64>(_socket->bytesToWrite(), MaxBacklog)));
+}
+
+/**
+ * (Re)connect, at most once a second, the writer may be starting or restarting
+ */
+void WriteForwarder::connectToWriter()
+{
+    if(_socket->state() != QLocalSocket::UnconnectedState)
+        return;
+    if(_lastAttempt.isValid() && _lastAttempt.elapsed() < 1000)
+        return;
+    _lastAttempt.start();
+    _socket->connectToServer(_serverName);
+}
+
+void WriteForwarder::onConnected()
+{
+    _connected.store(1);
+    LOG_INFO("forwarder", tr("connected writer=%1").arg(_serverName));
+}
+
+void WriteForwarder::onDisconnected()
+{
+    _connected.store(0);
+    _backlog.store(0);
+    LOG_WARNING("forwarder", tr("disconnected writer=%1").arg(_serverName));
+}
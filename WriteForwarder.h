@@ -0,0 +1,50 @@
+﻿#ifndef WRITEFORWARDER_H
+#define WRITEFORWARDER_H
+
+#include "WriteEvent.h"
+
+#include <QObject>
+#include <QMutex>
+#include <QList>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+class QLocalSocket;
+
+// Sends write events to the writer process, see WriteReceiver
+// forward() may be called from any thread, the events are sent on the forwarder's thread.
+// When the writer can't be reached, forward() returns false, and the caller writes locally,
+// which SQLite allows, just with more lock contention. So does the caller when the writer
+// falls behind, i.e., the bytes it hasn't read yet back up into the socket
+// Forwarded events are not acknowledged: delivery is at most once. The events in flight when
+// the writer restarts, or when this process is killed, are lost, though the client got its 200
+class WriteForwarder : public QObject
+{
+    Q_OBJECT
+
+public:
+    WriteForwarder(const QString& serverName, int capacity, QObject* parent = 0);
+    bool forward(const WriteEvent& event);   // false if the writer is unreachable or too far behind
+
+public slots:
+    void flush();   // send the pending events now
+    bool drain(int timeout);   // send them and block until the writer has them all, false on timeout
+
+private slots:
+    void connectToWriter();
+    void onConnected();
+    void onDisconnected();
+    void onBytesWritten();
+
+private:
+    QString           _serverName;
+    QLocalSocket*     _socket;
+    QAtomicInt        _connected;
+    QAtomicInt        _backlog;    // bytes sent but not taken by the writer yet
+    QMutex            _mutex;      // guards _pending
+    QList<WriteEvent> _pending;    // waiting to be sent
+    int               _capacity;   // max # of pending events
+    QElapsedTimer     _lastAttempt;   // to throttle reconnecting
+};
+
+#endif // WRITEFORWARDER_H
@@ -0,0 +1,85 @@
+﻿#include "WriteReceiver.h"
+#include "WriteBehindQueue.h"
+#include "Logger.h"
+#include "Settings.h"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QDataStream>
+#include <QTimer>
+
+static const int RetryInterval = 10;   // ms between attempts at a full queue
+
+WriteReceiver::WriteReceiver(const QString& serverName, QObject* parent)
+    : QObject(parent)
+{
+    _server = new QLocalServer(this);
+    connect(_server, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+
+    _retryTimer = new QTimer(this);
+    _retryTimer->setSingleShot(true);
+    _retryTimer->setInterval(RetryInterval);
+    connect(_retryTimer, SIGNAL(timeout()), this, SLOT(onRetry()));
+
+    QLocalServer::removeServer(serverName);   // left over by a crashed writer
+    if(!_server->listen(serverName))
+        LOG_ERROR("receiver", tr("can not listen name=%1 error=%2").arg(serverName).arg(_server->errorString()));
+}
+
+void WriteReceiver::onNewConnection()
+{
+    while(QLocalSocket* socket = _server->nextPendingConnection())
+    {
+        // bytes read ahead of the queue: room for the largest event, whose strings come
+        // from a body of up to MaxBodySize bytes, as UTF-16
+        socket->setReadBufferSize(2 * Settings::getInstance()->getMaxBodySize() + 64 * 1024);
+        connect(socket, SIGNAL(readyRead()),    this,   SLOT(onReadyRead()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void WriteReceiver::onReadyRead() {
+    receive(static_cast<QLocalSocket*>(sender()));
+}
+
+void WriteReceiver::onRetry()
+{
+    QList<QPointer<QLocalSocket> > stalled;
+    stalled.swap(_stalled);
+    foreach(const QPointer<QLocalSocket>& socket, stalled)
+        if(socket != 0)
+            receive(socket);
+}
+
+/**
+ * Queue every complete event received, a partial one waits for the rest of its bytes
+ * An event the queue has no room for is left in the socket, and the socket retried later
+ */
+void WriteReceiver::receive(QLocalSocket* socket)
+{
+    if(_stalled.contains(socket))   // its retry is due, the events stay in order
+        return;
+
+    QDataStream in(socket);
+    in.setVersion(QDataStream::Qt_5_0);
+    for(;;)
+    {
+        in.startTransaction();
+        WriteEvent event;
+        in >> event;
+        if(in.status() != QDataStream::Ok)   // incomplete
+        {
+            in.rollbackTransaction();
+            break;
+        }
+        if(!WriteBehindQueue::getInstance()->enqueue(event))
+        {
+            in.rollbackTransaction();   // unread, and read again by the retry
+            _stalled << socket;
+            _retryTimer->start();
+            LOG_DEBUG("receiver", tr("write queue full, retrying in %1 ms").arg(RetryInterval));
+            break;
+        }
+        in.commitTransaction();
+    }
+}
@@ -0,0 +1,39 @@
+﻿#ifndef WRITERECEIVER_H
+#define WRITERECEIVER_H
+
+#include <QObject>
+#include <QList>
+#include <QPointer>
+
+class QLocalServer;
+class QLocalSocket;
+class QTimer;
+
+// Runs in the designated writer process, and queues the write events that the other
+// worker processes forward to it, so that one process does all the batched writing
+// Events arrive as QDataStream-serialized WriteEvents, see WriteForwarder
+// When the write queue is full, an event stays unread in its socket, and is retried shortly.
+// The socket's read buffer is bounded, so the unread bytes back up into the forwarder, which
+// then turns events away for its process to queue locally, or to answer 503
+class WriteReceiver : public QObject
+{
+    Q_OBJECT
+
+public:
+    WriteReceiver(const QString& serverName, QObject* parent = 0);
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onRetry();
+
+private:
+    void receive(QLocalSocket* socket);
+
+private:
+    QLocalServer* _server;
+    QTimer*       _retryTimer;
+    QList<QPointer<QLocalSocket> > _stalled;   // with events the queue had no room for
+};
+
+#endif // WRITERECEIVER_H